@@ -0,0 +1,226 @@
+// Brian Chrzanowski
+// Edge Anti-Aliasing
+//
+// Supersampling the whole frame costs AA_GRID^2 times the raster, but almost every pixel is nowhere
+// near an edge. A cell is convex, so if a pixel and its 8 neighbours all have the same label, the
+// square between their centers is inside that cell, and so is the whole pixel. Only pixels with a
+// different label somewhere around them get AA_GRID x AA_GRID samples, and the samples only look
+// at the points owning that 3x3 block instead of every point. Everything else is a palette lookup
+// like ResolvePalette.
+//
+// NOTE (Brian) a cell thinner than a pixel can hide between two pixel centers and get missed, the
+// same way it gets missed without anti-aliasing. The samples are all euclid, so main doesn't allow
+// -aa with any other -metric.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+#define AA_GRID 4
+#define AA_SAMPLES (AA_GRID * AA_GRID)
+
+bool G_AA;
+
+static atomic_llong aa_edge_pixels;
+
+// AASample: the average color of the grid of samples over pixel (x, y), looking only at candidates
+static uint32_t AASample(Point *points, uint32_t *palette, Label *candidates, int candidates_len, int x, int y)
+{
+	uint32_t r = 0, g = 0, b = 0;
+
+	for (int j = 0; j < AA_GRID; j++) {
+		float sy = y + (j + 0.5f) / AA_GRID - 0.5f;
+		for (int i = 0; i < AA_GRID; i++) {
+			float sx = x + (i + 0.5f) / AA_GRID - 0.5f;
+			float min = FLT_MAX;
+			Label picked = candidates[0];
+
+			for (int k = 0; k < candidates_len; k++) {
+				Point *p = points + candidates[k];
+				float xd = p->px - sx;
+				float yd = p->py - sy;
+				float currdist = METRIC_EUCLID(p, xd, yd);
+				if (currdist < min || (currdist == min && candidates[k] < picked)) {
+					min = currdist;
+					picked = candidates[k];
+				}
+			}
+
+			Pixel c = { .color = palette[picked] };
+			r += c.r;
+			g += c.g;
+			b += c.b;
+		}
+	}
+
+	Pixel out = {
+		.r = (r + AA_SAMPLES / 2) / AA_SAMPLES,
+		.g = (g + AA_SAMPLES / 2) / AA_SAMPLES,
+		.b = (b + AA_SAMPLES / 2) / AA_SAMPLES,
+		.a = 0xff,
+	};
+
+	return out.color;
+}
+
+// ResolveAA: ResolvePalette, but pixels on a cell edge get supersampled
+void ResolveAA(Pixel *pixels, Label *labels, uint32_t *palette, Point *points, int x0, int y0, int x1, int y1)
+{
+	long long edges = 0;
+
+	for (int y = y0; y < y1; y++) {
+		int ylo = y > 0 ? y - 1 : y;
+		int yhi = y < G_HEIGHT - 1 ? y + 1 : y;
+
+		for (int x = x0; x < x1; x++) {
+			int xlo = x > 0 ? x - 1 : x;
+			int xhi = x < G_WIDTH - 1 ? x + 1 : x;
+			Label label = labels[x + G_WIDTH * y];
+			Label *above = labels + G_WIDTH * ylo, *row = labels + G_WIDTH * y, *below = labels + G_WIDTH * yhi;
+
+			// NOTE (Brian) the same label all around is by far the most common case, check that first
+			bool interior =
+				above[xlo] == label && above[x] == label && above[xhi] == label &&
+				row[xlo] == label && row[xhi] == label &&
+				below[xlo] == label && below[x] == label && below[xhi] == label;
+
+			if (interior) {
+				pixels[x + G_WIDTH * y].color = palette[label];
+				continue;
+			}
+
+			Label candidates[9];
+			int candidates_len = 0;
+
+			for (int ny = ylo; ny <= yhi; ny++) {
+				for (int nx = xlo; nx <= xhi; nx++) {
+					Label other = labels[nx + G_WIDTH * ny];
+					int k = 0;
+					while (k < candidates_len && candidates[k] != other)
+						k++;
+					if (k == candidates_len)
+						candidates[candidates_len++] = other;
+				}
+			}
+
+			pixels[x + G_WIDTH * y].color = AASample(points, palette, candidates, candidates_len, x, y);
+			edges++;
+		}
+	}
+
+	atomic_fetch_add(&aa_edge_pixels, edges);
+}
+
+// SSAAPixel: the reference, every sample looks at every point
+static uint32_t SSAAPixel(Point *points, int points_len, uint32_t *palette, int x, int y)
+{
+	uint32_t r = 0, g = 0, b = 0;
+
+	for (int j = 0; j < AA_GRID; j++) {
+		float sy = y + (j + 0.5f) / AA_GRID - 0.5f;
+		for (int i = 0; i < AA_GRID; i++) {
+			float sx = x + (i + 0.5f) / AA_GRID - 0.5f;
+			int picked;
+
+			NEAREST_POINT(METRIC_EUCLID, picked, sx, sy, points, points_len);
+
+			Pixel c = { .color = palette[picked] };
+			r += c.r;
+			g += c.g;
+			b += c.b;
+		}
+	}
+
+	Pixel out = {
+		.r = (r + AA_SAMPLES / 2) / AA_SAMPLES,
+		.g = (g + AA_SAMPLES / 2) / AA_SAMPLES,
+		.b = (b + AA_SAMPLES / 2) / AA_SAMPLES,
+		.a = 0xff,
+	};
+
+	return out.color;
+}
+
+// AAError: mean and max per channel difference between two frames
+static void AAError(Pixel *a, Pixel *b, size_t total, double *mean, int *max)
+{
+	long long sum = 0;
+
+	*max = 0;
+	for (size_t i = 0; i < total; i++) {
+		int d[3] = { abs(a[i].r - b[i].r), abs(a[i].g - b[i].g), abs(a[i].b - b[i].b) };
+		for (int c = 0; c < 3; c++) {
+			sum += d[c];
+			if (*max < d[c])
+				*max = d[c];
+		}
+	}
+
+	*mean = (double)sum / (3.0 * total);
+}
+
+// BenchAA: compares the aliased frame, edge-only supersampling, and supersampling every pixel
+void BenchAA(Engine *engine, Point *points, int points_len)
+{
+	const int frames = 5;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	Label *labels = calloc(total, sizeof(*labels));
+	Pixel *aliased = calloc(total, sizeof(*aliased));
+	Pixel *adaptive = calloc(total, sizeof(*adaptive));
+	Pixel *reference = calloc(total, sizeof(*reference));
+	uint32_t *palette = malloc(points_len * sizeof(*palette));
+	assert(labels != NULL && aliased != NULL && adaptive != NULL && reference != NULL && palette != NULL);
+
+	BuildPalette(palette, points, points_len, 0);
+
+	double start = GetTime();
+	for (int f = 0; f < frames; f++) {
+		RenderFrame(engine, labels, points);
+		ResolvePalette(aliased, labels, palette, 0, 0, G_WIDTH, G_HEIGHT);
+	}
+	double plain = (GetTime() - start) / frames;
+
+	atomic_store(&aa_edge_pixels, 0);
+
+	start = GetTime();
+	for (int f = 0; f < frames; f++) {
+		RenderFrame(engine, labels, points);
+		ResolveAA(adaptive, labels, palette, points, 0, 0, G_WIDTH, G_HEIGHT);
+	}
+	double edge = (GetTime() - start) / frames;
+
+	long long edges = atomic_exchange(&aa_edge_pixels, 0) / frames;
+
+	start = GetTime();
+	for (int y = 0; y < G_HEIGHT; y++) {
+		for (int x = 0; x < G_WIDTH; x++)
+			reference[x + G_WIDTH * y].color = SSAAPixel(points, points_len, palette, x, y);
+	}
+	double full = GetTime() - start;
+
+	double aliased_mean, adaptive_mean;
+	int aliased_max, adaptive_max;
+	AAError(aliased, reference, total, &aliased_mean, &aliased_max);
+	AAError(adaptive, reference, total, &adaptive_mean, &adaptive_max);
+
+	printf("%s, %d points, %dx%d, %dx%d samples\n", engine->name, points_len, G_WIDTH, G_HEIGHT, AA_GRID, AA_GRID);
+	printf("  Aliased       %8.3fms  error vs %dx SSAA avg %.3f max %d\n",
+		plain * 1000, AA_SAMPLES, aliased_mean, aliased_max);
+	printf("  Edge AA       %8.3fms  error vs %dx SSAA avg %.3f max %d, %.2fx the aliased frame\n",
+		edge * 1000, AA_SAMPLES, adaptive_mean, adaptive_max, edge / plain);
+	printf("  Full SSAA     %8.3fms  (brute force, every sample against every point)\n", full * 1000);
+	printf("  Edge Pixels   %lld of %zu (%.2f%%)\n", edges, total, 100.0 * edges / total);
+
+	free(palette);
+	free(reference);
+	free(adaptive);
+	free(aliased);
+	free(labels);
+}
@@ -0,0 +1,172 @@
+// Brian Chrzanowski
+// Barriers
+//
+// Two ways of holding a fixed set of threads until all of them have arrived.
+//
+// The central one is the usual sense-reversing barrier: everyone decrements one counter, the last
+// one to get there resets it and flips the shared sense, and everyone else waits for the flip. It's
+// one atomic per thread and one cache line that everyone fights over, which is fine for a handful of
+// threads.
+//
+// The dissemination one never has more than two threads touching a cache line. In round r, thread i
+// signals thread i + 2^r and waits for thread i - 2^r to signal it, so after ceil(log2 n) rounds
+// everyone has heard from everyone, directly or not. Every thread's flags live in their own cache
+// line, and they're double buffered by parity so a fast thread can't trip a flag its partner hasn't
+// looked at yet from the last time.
+//
+// Both of them wait with PoolAwait, so a thread that's early spins for a bit and then goes to sleep.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+// enough for POOL_MAX_CPUS threads
+#define BARRIER_MAX_ROUNDS 10
+
+int G_Barrier = BARRIER_CENTRAL;
+
+struct BarrierSlot {
+	_Alignas(64) atomic_int flags[2][BARRIER_MAX_ROUNDS]; // written by our partners, read by us
+	atomic_int sleepers;
+	int parity;
+	int sense;
+};
+
+// BarrierInit: a barrier for threads threads, numbered 0 to threads - 1
+void BarrierInit(Barrier *barrier, int threads, int kind)
+{
+	assert(threads > 0);
+
+	memset(barrier, 0, sizeof(*barrier));
+	barrier->kind = kind;
+	barrier->threads = threads;
+
+	while ((1 << barrier->rounds) < threads)
+		barrier->rounds++;
+	assert(barrier->rounds <= BARRIER_MAX_ROUNDS);
+
+	barrier->alloc = calloc(threads + 1, sizeof(*barrier->slots));
+	assert(barrier->alloc != NULL);
+	barrier->slots = (struct BarrierSlot *)(((uintptr_t)barrier->alloc + 63) & ~(uintptr_t)63);
+
+	atomic_store(&barrier->count, threads);
+	for (int i = 0; i < threads; i++)
+		barrier->slots[i].sense = 1;
+}
+
+void BarrierFree(Barrier *barrier)
+{
+	free(barrier->alloc);
+	barrier->alloc = NULL;
+	barrier->slots = NULL;
+}
+
+// BarrierCentral: counter and sense reversal
+static void BarrierCentral(Barrier *barrier, struct BarrierSlot *self)
+{
+	int sense = self->sense;
+	self->sense = !sense;
+
+	if (atomic_fetch_sub(&barrier->count, 1) == 1) {
+		// NOTE (Brian) nobody touches the counter again until they've seen the flip, so it's safe to
+		// put it back before flipping
+		atomic_store_explicit(&barrier->count, barrier->threads, memory_order_relaxed);
+		atomic_store(&barrier->sense, sense);
+		if (atomic_load(&barrier->sleepers) > 0)
+			PoolWake(&barrier->sense);
+		return;
+	}
+
+	while (atomic_load_explicit(&barrier->sense, memory_order_acquire) != sense)
+		PoolAwait(&barrier->sense, !sense, &barrier->sleepers);
+}
+
+// BarrierDisseminate: log2(n) rounds of pairwise signals
+static void BarrierDisseminate(Barrier *barrier, int thread, struct BarrierSlot *self)
+{
+	int parity = self->parity;
+	int sense = self->sense;
+
+	for (int r = 0; r < barrier->rounds; r++) {
+		struct BarrierSlot *partner = barrier->slots + (thread + (1 << r)) % barrier->threads;
+
+		atomic_store(&partner->flags[parity][r], sense);
+		if (atomic_load(&partner->sleepers) > 0)
+			PoolWake(&partner->flags[parity][r]);
+
+		while (atomic_load_explicit(&self->flags[parity][r], memory_order_acquire) != sense)
+			PoolAwait(&self->flags[parity][r], !sense, &self->sleepers);
+	}
+
+	if (parity == 1)
+		self->sense = !sense;
+	self->parity = !parity;
+}
+
+// BarrierWait: returns once every thread has called it, thread is the caller's number
+void BarrierWait(Barrier *barrier, int thread)
+{
+	assert(thread >= 0 && thread < barrier->threads);
+
+	if (barrier->threads == 1)
+		return;
+
+	struct BarrierSlot *self = barrier->slots + thread;
+
+	if (barrier->kind == BARRIER_DISSEMINATION)
+		BarrierDisseminate(barrier, thread, self);
+	else
+		BarrierCentral(barrier, self);
+}
+
+typedef struct {
+	Barrier barrier;
+	int rounds;
+} BarrierJob;
+
+static void BarrierSpin(void *arg, int worker, int workers)
+{
+	BarrierJob *job = arg;
+	for (int i = 0; i < job->rounds; i++)
+		BarrierWait(&job->barrier, worker);
+}
+
+// BenchBarrier: how long one barrier takes with 1, 2, 4, ... threads up to threads, both kinds
+void BenchBarrier(int threads)
+{
+	static char *kinds[] = { "central", "dissemination" };
+	const int rounds = 20000;
+
+	printf("%d rounds per run\n", rounds);
+
+	for (int n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+		PoolStart(n);
+
+		for (int kind = 0; kind < 2; kind++) {
+			BarrierJob job = { .rounds = 100 };
+			BarrierInit(&job.barrier, n, kind);
+
+			// warm up, so every worker is awake and has its slot in cache
+			PoolRun(BarrierSpin, &job);
+
+			job.rounds = rounds;
+
+			double start = GetTime();
+			PoolRun(BarrierSpin, &job);
+			double elapsed = (GetTime() - start) / rounds;
+
+			printf("  %3d threads  %-14s %8.3fus per barrier\n", n, kinds[kind], elapsed * 1e6);
+
+			BarrierFree(&job.barrier);
+		}
+
+		PoolStop();
+
+		if (n == threads)
+			break;
+	}
+}
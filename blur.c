@@ -0,0 +1,275 @@
+// Brian Chrzanowski
+// Motion Blur
+//
+// A blurred frame is the average of G_Blur sub-frames, with every point slid part of the way from
+// where it is to where MovePoint is about to put it. Drawing each sub-frame from scratch costs
+// G_Blur times a frame, but a pixel only comes out blurred if its owner changes somewhere over the
+// interval, and that can be ruled out up front.
+//
+// The sub-frames span (G_Blur - 1) / G_Blur of a step, so no point gets further than dev, half of
+// that times the longest step, from where it is in the middle sub-frame, and no distance to a pixel
+// changes by more than dev either. If the closest point in the middle sub-frame beats the second closest by
+// more than 2 * dev, it's the closest in every sub-frame, and the pixel is just its color. Otherwise
+// only the points within 2 * dev of the closest one can ever win, so those are the only ones the
+// sub-frames look at.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+// past this many, an edge pixel just checks every point
+#define BLUR_CANDIDATES 16
+
+// float slack on top of the bound, in pixels
+#define BLUR_EPSILON 1e-3f
+
+int G_Blur;
+
+static Point *blur_sub; // G_Blur sub-frames of blur_points_len points each, then the middle one
+static int blur_sub_cap;
+static Point *blur_mid;
+static int blur_points_len;
+static float blur_step_max; // the furthest any point goes in a frame
+static float blur_reach; // how much closer the runner up has to be before the owner could change
+
+static atomic_llong blur_edge_pixels;
+static atomic_llong blur_pixels;
+
+// BlurLerp: points slid f of the way to next
+static void BlurLerp(Point *out, Point *points, Point *next, int points_len, float f)
+{
+	for (int i = 0; i < points_len; i++) {
+		out[i] = points[i];
+		out[i].px = points[i].px + (next[i].px - points[i].px) * f;
+		out[i].py = points[i].py + (next[i].py - points[i].py) * f;
+	}
+}
+
+// BlurBegin: the sub-frames between points and next, call before ResolveBlur on every frame
+void BlurBegin(Point *points, Point *next, int points_len)
+{
+	int k = G_Blur;
+
+	if (blur_sub_cap < (k + 1) * points_len) {
+		free(blur_sub);
+		blur_sub_cap = (k + 1) * points_len;
+		blur_sub = malloc(blur_sub_cap * sizeof(*blur_sub));
+		assert(blur_sub != NULL);
+	}
+
+	blur_points_len = points_len;
+	blur_mid = blur_sub + k * points_len;
+
+	for (int s = 0; s < k; s++)
+		BlurLerp(blur_sub + s * points_len, points, next, points_len, (float)s / k);
+
+	// NOTE (Brian) the middle is only one of the sub-frames when G_Blur is odd, the rest of the time
+	// it's halfway between two of them
+	float mid = (float)(k - 1) / (2 * k);
+	BlurLerp(blur_mid, points, next, points_len, mid);
+
+	blur_step_max = 0;
+	for (int i = 0; i < points_len; i++) {
+		float d = hypotf(next[i].px - points[i].px, next[i].py - points[i].py);
+		if (blur_step_max < d)
+			blur_step_max = d;
+	}
+
+	blur_reach = 2 * blur_step_max * mid + BLUR_EPSILON;
+}
+
+// BlurSample: the average of the sub-frames' colors at pixel (x, y), looking only at candidates, or
+// every point when candidates is NULL
+static uint32_t BlurSample(uint32_t *palette, int *candidates, int candidates_len, int x, int y)
+{
+	uint32_t r = 0, g = 0, b = 0;
+
+	for (int s = 0; s < G_Blur; s++) {
+		Point *sub = blur_sub + s * blur_points_len;
+		int picked;
+
+		if (candidates == NULL) {
+			NEAREST_POINT(METRIC_EUCLID, picked, x, y, sub, blur_points_len);
+		} else {
+			float min = FLT_MAX;
+			picked = candidates[0];
+			for (int j = 0; j < candidates_len; j++) {
+				Point *p = sub + candidates[j];
+				float xd = p->px - x;
+				float yd = p->py - y;
+				float currdist = METRIC_EUCLID(p, xd, yd);
+				if (currdist < min) {
+					min = currdist;
+					picked = candidates[j];
+				}
+			}
+		}
+
+		Pixel c = { .color = palette[picked] };
+		r += c.r;
+		g += c.g;
+		b += c.b;
+	}
+
+	Pixel out = {
+		.r = (r + G_Blur / 2) / G_Blur,
+		.g = (g + G_Blur / 2) / G_Blur,
+		.b = (b + G_Blur / 2) / G_Blur,
+		.a = 0xff,
+	};
+
+	return out.color;
+}
+
+// ResolveBlur: the blurred colors of [x0, x1) x [y0, y1), straight from the points, no labels needed
+void ResolveBlur(Pixel *pixels, uint32_t *palette, int x0, int y0, int x1, int y1)
+{
+	long long edges = 0;
+
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			float d1 = FLT_MAX, d2 = FLT_MAX;
+			int owner = 0;
+
+			for (int i = 0; i < blur_points_len; i++) {
+				float xd = blur_mid[i].px - x;
+				float yd = blur_mid[i].py - y;
+				float d = xd * xd + yd * yd;
+				if (d < d1) {
+					d2 = d1;
+					d1 = d;
+					owner = i;
+				} else if (d < d2) {
+					d2 = d;
+				}
+			}
+
+			float near = sqrtf(d1);
+
+			if (sqrtf(d2) - near > blur_reach) {
+				pixels[x + G_WIDTH * y].color = palette[owner];
+				continue;
+			}
+
+			// the candidates stay in index order, so ties go the same way NEAREST_POINT sends them
+			int candidates[BLUR_CANDIDATES];
+			int candidates_len = 0;
+			float limit = (near + blur_reach) * (near + blur_reach);
+
+			for (int i = 0; i < blur_points_len && candidates_len <= BLUR_CANDIDATES; i++) {
+				float xd = blur_mid[i].px - x;
+				float yd = blur_mid[i].py - y;
+				if (xd * xd + yd * yd <= limit) {
+					if (candidates_len == BLUR_CANDIDATES) {
+						candidates_len++;
+						break;
+					}
+					candidates[candidates_len++] = i;
+				}
+			}
+
+			if (candidates_len > BLUR_CANDIDATES)
+				pixels[x + G_WIDTH * y].color = BlurSample(palette, NULL, 0, x, y);
+			else
+				pixels[x + G_WIDTH * y].color = BlurSample(palette, candidates, candidates_len, x, y);
+			edges++;
+		}
+	}
+
+	atomic_fetch_add(&blur_edge_pixels, edges);
+	atomic_fetch_add(&blur_pixels, (long long)(x1 - x0) * (y1 - y0));
+}
+
+// BlurReport: how many pixels needed their sub-frames since the last report
+void BlurReport()
+{
+	long long edges = atomic_exchange(&blur_edge_pixels, 0);
+	long long total = atomic_exchange(&blur_pixels, 0);
+
+	if (total > 0)
+		printf("  Blur          %d sub-frames, %.2f%% of pixels sampled them\n", G_Blur, 100.0 * edges / total);
+}
+
+// BenchBlur: the blurred frame against drawing every sub-frame from scratch and averaging them
+void BenchBlur(Point *points, int points_len)
+{
+	const int frames = 3;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	if (G_Blur < 2)
+		G_Blur = 8;
+
+	Pixel *fast = calloc(total, sizeof(*fast));
+	Pixel *reference = calloc(total, sizeof(*reference));
+	uint32_t (*sums)[3] = calloc(total, sizeof(*sums));
+	Point *next = malloc(points_len * sizeof(*next));
+	uint32_t *palette = malloc(points_len * sizeof(*palette));
+	assert(fast != NULL && reference != NULL && sums != NULL && next != NULL && palette != NULL);
+
+	memcpy(next, points, points_len * sizeof(*points));
+	for (int i = 0; i < points_len; i++)
+		MovePoint(next + i);
+
+	BuildPalette(palette, points, points_len, 0);
+	BlurBegin(points, next, points_len);
+
+	double start = GetTime();
+	for (int f = 0; f < frames; f++) {
+		memset(sums, 0, total * sizeof(*sums));
+
+		for (int s = 0; s < G_Blur; s++) {
+			Point *sub = blur_sub + s * points_len;
+			for (int y = 0; y < G_HEIGHT; y++) {
+				for (int x = 0; x < G_WIDTH; x++) {
+					int picked;
+					NEAREST_POINT(METRIC_EUCLID, picked, x, y, sub, points_len);
+					Pixel c = { .color = palette[picked] };
+					sums[x + G_WIDTH * y][0] += c.r;
+					sums[x + G_WIDTH * y][1] += c.g;
+					sums[x + G_WIDTH * y][2] += c.b;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < total; i++) {
+			reference[i].r = (sums[i][0] + G_Blur / 2) / G_Blur;
+			reference[i].g = (sums[i][1] + G_Blur / 2) / G_Blur;
+			reference[i].b = (sums[i][2] + G_Blur / 2) / G_Blur;
+			reference[i].a = 0xff;
+		}
+	}
+	double brute = (GetTime() - start) / frames;
+
+	atomic_store(&blur_edge_pixels, 0);
+	atomic_store(&blur_pixels, 0);
+
+	start = GetTime();
+	for (int f = 0; f < frames; f++)
+		ResolveBlur(fast, palette, 0, 0, G_WIDTH, G_HEIGHT);
+	double blurred = (GetTime() - start) / frames;
+
+	long long edges = atomic_exchange(&blur_edge_pixels, 0) / frames;
+	atomic_store(&blur_pixels, 0);
+
+	size_t differ = 0;
+	for (size_t i = 0; i < total; i++)
+		differ += fast[i].color != reference[i].color;
+
+	printf("%d points, %dx%d, %d sub-frames, points move up to %.2fpx a frame\n", points_len, G_WIDTH, G_HEIGHT,
+		G_Blur, blur_step_max);
+	printf("  Brute Force   %8.3fms  (every sub-frame drawn and averaged)\n", brute * 1000);
+	printf("  Blur          %8.3fms  %.2fx faster, %lld pixels (%.2f%%) sampled the sub-frames, %zu differ\n",
+		blurred * 1000, brute / blurred, edges, 100.0 * edges / total, differ);
+
+	free(palette);
+	free(next);
+	free(sums);
+	free(reference);
+	free(fast);
+}
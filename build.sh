@@ -0,0 +1,3 @@
+#!/bin/sh
+
+clang -g3 -ffp-contract=off -o BrianTool *.c -lm -lpthread
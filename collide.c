@@ -0,0 +1,461 @@
+// Brian Chrzanowski
+// Seed Collisions
+//
+// With G_Collide, every point is a disc of G_Radius, and discs that overlap while moving towards
+// each other bounce off like billiard balls of the same mass: each one loses the part of its
+// velocity along the line between them, relative to the other one, and gets the other one's.
+//
+// Finding who overlaps goes through a grid of cells one diameter across, rebuilt every step with a
+// counting sort, so a point only has to look at the points in the 3x3 cells around its own. The
+// sort is done by the whole pool: every worker counts its share of the points into its own row of
+// counts, turns a range of cells into offsets, and scatters its share into place. Since the shares
+// are in order, every cell ends up listing its points by index, no matter how many workers.
+//
+// Every point picks the one it's closing in on fastest, and the pairs that picked each other bounce.
+// Bouncing off everything at once would be simpler, but in a pile the pushes add up to more energy
+// than there was, and scaling them down to fix that bleeds energy until everything clumps together.
+// One bounce per pair per step keeps both energy and momentum exact, and whatever didn't get a turn
+// is still closing in next step. Every point only writes its own velocity, from the old ones, so
+// workers never write to the same point and the result doesn't depend on the order anything ran in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+bool G_Collide;
+float G_Radius = 4.0f;
+
+typedef struct {
+	_Alignas(64) long long touching; // contacts closing in
+	long long bounced; // points that bounced
+	long long steps;
+	double broad_time;
+	double narrow_time;
+	int range_sum; // points in this worker's range of cells
+} CollideWorker;
+
+static int collide_points_len;
+static int collide_workers_len;
+static int collide_cols, collide_rows, collide_cells;
+static float collide_size; // cell size, one diameter
+
+static int *collide_cell_of; // by point
+static int *collide_counts; // a row of collide_cells for every worker, then its offsets
+static int *collide_start; // the first entry of every cell in collide_sorted, and one past the end
+static int *collide_sorted; // point indices, cell by cell
+static int *collide_partner; // by point, the one it picked to bounce off this step
+static float *collide_vx; // the velocities after this step's collisions
+static float *collide_vy;
+static CollideWorker *collide_workers;
+static void *collide_alloc;
+
+// CollideInit: the grid and scratch space for points_len points on workers workers
+void CollideInit(int workers, int points_len)
+{
+	CollideFree();
+
+	collide_size = 2 * G_Radius;
+	collide_cols = (int)ceilf(G_WIDTH / collide_size) + 1;
+	collide_rows = (int)ceilf(G_HEIGHT / collide_size) + 1;
+	collide_cells = collide_cols * collide_rows;
+	collide_points_len = points_len;
+	collide_workers_len = workers;
+
+	collide_cell_of = malloc(points_len * sizeof(*collide_cell_of));
+	collide_counts = malloc((size_t)workers * collide_cells * sizeof(*collide_counts));
+	collide_start = malloc((collide_cells + 1) * sizeof(*collide_start));
+	collide_sorted = malloc(points_len * sizeof(*collide_sorted));
+	collide_partner = malloc(points_len * sizeof(*collide_partner));
+	collide_vx = malloc(points_len * sizeof(*collide_vx));
+	collide_vy = malloc(points_len * sizeof(*collide_vy));
+	collide_alloc = calloc(workers + 1, sizeof(*collide_workers));
+	assert(collide_cell_of != NULL && collide_counts != NULL && collide_start != NULL && collide_sorted != NULL);
+	assert(collide_partner != NULL);
+	assert(collide_vx != NULL && collide_vy != NULL && collide_alloc != NULL);
+
+	collide_workers = (CollideWorker *)(((uintptr_t)collide_alloc + 63) & ~(uintptr_t)63);
+}
+
+void CollideFree()
+{
+	free(collide_cell_of);
+	free(collide_counts);
+	free(collide_start);
+	free(collide_sorted);
+	free(collide_partner);
+	free(collide_vx);
+	free(collide_vy);
+	free(collide_alloc);
+
+	collide_cell_of = collide_counts = collide_start = collide_sorted = collide_partner = NULL;
+	collide_vx = collide_vy = NULL;
+	collide_workers = NULL;
+	collide_alloc = NULL;
+	collide_workers_len = 0;
+}
+
+// CollideCell: the cell a position falls in, anything past the edges goes in the cells on the edge
+static int CollideCell(float x, float y)
+{
+	int col = (int)(x / collide_size);
+	int row = (int)(y / collide_size);
+
+	// NOTE (Brian) clamping only ever puts points closer together, so it can't hide a contact
+	col = x < 0 ? 0 : col >= collide_cols ? collide_cols - 1 : col;
+	row = y < 0 ? 0 : row >= collide_rows ? collide_rows - 1 : row;
+
+	return col + collide_cols * row;
+}
+
+// CollidePartner: the point i is closing in on fastest out of all the ones it's touching, or -1, and
+// how many it's touching
+static int CollidePartner(PointSet *set, int i, int *touching)
+{
+	float reach = collide_size * collide_size;
+	float px = set->px[i], py = set->py[i];
+	float vx = set->vx[i], vy = set->vy[i];
+	float best = 0;
+	int partner = -1;
+
+	int cell = collide_cell_of[i];
+	int col = cell % collide_cols, row = cell / collide_cols;
+
+	*touching = 0;
+
+	for (int r = row - 1; r <= row + 1; r++) {
+		if (r < 0 || r >= collide_rows)
+			continue;
+
+		for (int c = col - 1; c <= col + 1; c++) {
+			if (c < 0 || c >= collide_cols)
+				continue;
+
+			int other = c + collide_cols * r;
+			for (int k = collide_start[other]; k < collide_start[other + 1]; k++) {
+				int j = collide_sorted[k];
+				float dx = px - set->px[j];
+				float dy = py - set->py[j];
+				float d2 = dx * dx + dy * dy;
+
+				if (j == i || d2 >= reach || d2 == 0)
+					continue;
+
+				// only if they're closing in, otherwise they're already coming apart
+				float closing = (vx - set->vx[j]) * dx + (vy - set->vy[j]) * dy;
+				if (closing >= 0)
+					continue;
+
+				(*touching)++;
+
+				// the speed they're closing in at, a tie goes to the lower index like everywhere else
+				float speed = -closing / sqrtf(d2);
+				if (speed > best || (speed == best && j < partner)) {
+					best = speed;
+					partner = j;
+				}
+			}
+		}
+	}
+
+	return partner;
+}
+
+// CollideBounce: i's velocity after bouncing off its partner, if they picked each other
+static bool CollideBounce(PointSet *set, int i)
+{
+	float vx = set->vx[i], vy = set->vy[i];
+	float px = set->px[i], py = set->py[i];
+	int j = collide_partner[i];
+	bool bounced = j >= 0 && collide_partner[j] == i;
+
+	if (bounced) {
+		float dx = px - set->px[j];
+		float dy = py - set->py[j];
+		float push = ((vx - set->vx[j]) * dx + (vy - set->vy[j]) * dy) / (dx * dx + dy * dy);
+
+		vx -= push * dx;
+		vy -= push * dy;
+	}
+
+	// NOTE (Brian) MovePoint turns around anything on or past a wall whichever way it's going, so a
+	// point that just got knocked back inside has to be handed over going out, or it gets stuck
+	if (px <= 0 || px >= G_WIDTH)
+		vx = px <= 0 ? -fabsf(vx) : fabsf(vx);
+	if (py <= 0 || py >= G_HEIGHT)
+		vy = py <= 0 ? -fabsf(vy) : fabsf(vy);
+
+	collide_vx[i] = vx;
+	collide_vy[i] = vy;
+
+	return bounced;
+}
+
+// CollideStep: called by every worker of a pool job, bounces the points of set off each other by
+// changing their velocities, MovePoint or PointSetStep still has to move them afterwards
+void CollideStep(PointSet *set, int worker, int workers)
+{
+	assert(workers == collide_workers_len && set->len == collide_points_len);
+
+	CollideWorker *self = collide_workers + worker;
+	double start = GetTime();
+
+	int lo = (int)((int64_t)set->len * worker / workers);
+	int hi = (int)((int64_t)set->len * (worker + 1) / workers);
+	int c0 = (int)((int64_t)collide_cells * worker / workers);
+	int c1 = (int)((int64_t)collide_cells * (worker + 1) / workers);
+	int *counts = collide_counts + (size_t)worker * collide_cells;
+
+	// count our own points into our own row
+	memset(counts, 0, collide_cells * sizeof(*counts));
+	for (int i = lo; i < hi; i++) {
+		int cell = CollideCell(set->px[i], set->py[i]);
+		collide_cell_of[i] = cell;
+		counts[cell]++;
+	}
+
+	PoolBarrier(worker);
+
+	// total up our range of cells over every worker
+	int sum = 0;
+	for (int w = 0; w < workers; w++) {
+		int *row = collide_counts + (size_t)w * collide_cells;
+		for (int c = c0; c < c1; c++)
+			sum += row[c];
+	}
+	self->range_sum = sum;
+
+	PoolBarrier(worker);
+
+	// our range starts after everyone before us, then every cell goes worker by worker
+	int offset = 0;
+	for (int w = 0; w < worker; w++)
+		offset += collide_workers[w].range_sum;
+
+	for (int c = c0; c < c1; c++) {
+		collide_start[c] = offset;
+		for (int w = 0; w < workers; w++) {
+			int *slot = collide_counts + (size_t)w * collide_cells + c;
+			int n = *slot;
+			*slot = offset;
+			offset += n;
+		}
+	}
+	if (worker == workers - 1)
+		collide_start[collide_cells] = set->len;
+
+	PoolBarrier(worker);
+
+	for (int i = lo; i < hi; i++)
+		collide_sorted[counts[collide_cell_of[i]]++] = i;
+
+	PoolBarrier(worker);
+
+	double broad = GetTime();
+	self->broad_time += broad - start;
+
+	long long touching = 0, bounced = 0;
+	for (int i = lo; i < hi; i++) {
+		int n;
+		collide_partner[i] = CollidePartner(set, i, &n);
+		touching += n;
+	}
+
+	PoolBarrier(worker);
+
+	for (int i = lo; i < hi; i++)
+		bounced += CollideBounce(set, i);
+
+	// nobody reads the old velocities once everyone has their new ones
+	PoolBarrier(worker);
+
+	memcpy(set->vx + lo, collide_vx + lo, (hi - lo) * sizeof(*set->vx));
+	memcpy(set->vy + lo, collide_vy + lo, (hi - lo) * sizeof(*set->vy));
+
+	self->touching += touching;
+	self->bounced += bounced;
+	self->narrow_time += GetTime() - broad;
+	self->steps++;
+}
+
+// CollideReport: contacts and time per step since the last report
+void CollideReport()
+{
+	if (collide_workers_len == 0 || collide_workers[0].steps == 0)
+		return;
+
+	long long touching = 0, bounced = 0;
+	for (int i = 0; i < collide_workers_len; i++) {
+		touching += collide_workers[i].touching;
+		bounced += collide_workers[i].bounced;
+		collide_workers[i].touching = 0;
+		collide_workers[i].bounced = 0;
+	}
+
+	CollideWorker *w = collide_workers;
+	printf("  Collisions    radius %.1f, %.1f contacts and %.1f bounces per step, broadphase %.3fms narrowphase %.3fms per step\n",
+		G_Radius, (double)touching / w->steps, (double)bounced / 2 / w->steps,
+		w->broad_time * 1000 / w->steps, w->narrow_time * 1000 / w->steps);
+
+	w->steps = 0;
+	w->broad_time = 0;
+	w->narrow_time = 0;
+}
+
+typedef struct {
+	PointSet *set;
+	int steps;
+} CollideBenchJob;
+
+static void CollideBenchWork(void *arg, int worker, int workers)
+{
+	CollideBenchJob *job = arg;
+	int lo = (int)((int64_t)job->set->len * worker / workers);
+	int hi = (int)((int64_t)job->set->len * (worker + 1) / workers);
+
+	for (int s = 0; s < job->steps; s++) {
+		CollideStep(job->set, worker, workers);
+		PointSetStep(job->set, lo, hi);
+	}
+}
+
+// CollideBrute: every pair, for checking the grid, partner has room for a point per point
+static void CollideBrute(PointSet *set, int *partner, float *vx, float *vy)
+{
+	float reach = 4 * G_Radius * G_Radius;
+
+	for (int i = 0; i < set->len; i++) {
+		float best = 0;
+		partner[i] = -1;
+
+		for (int j = 0; j < set->len; j++) {
+			float dx = set->px[i] - set->px[j];
+			float dy = set->py[i] - set->py[j];
+			float d2 = dx * dx + dy * dy;
+			if (j == i || d2 >= reach || d2 == 0)
+				continue;
+
+			float closing = (set->vx[i] - set->vx[j]) * dx + (set->vy[i] - set->vy[j]) * dy;
+			float speed = -closing / sqrtf(d2);
+			if (closing < 0 && speed > best) {
+				best = speed;
+				partner[i] = j;
+			}
+		}
+	}
+
+	for (int i = 0; i < set->len; i++) {
+		int j = partner[i];
+		float px = set->px[i], py = set->py[i];
+
+		vx[i] = set->vx[i];
+		vy[i] = set->vy[i];
+
+		if (j >= 0 && partner[j] == i) {
+			float dx = px - set->px[j];
+			float dy = py - set->py[j];
+			float push = ((vx[i] - set->vx[j]) * dx + (vy[i] - set->vy[j]) * dy) / (dx * dx + dy * dy);
+			vx[i] -= push * dx;
+			vy[i] -= push * dy;
+		}
+
+		if (px <= 0 || px >= G_WIDTH)
+			vx[i] = px <= 0 ? -fabsf(vx[i]) : fabsf(vx[i]);
+		if (py <= 0 || py >= G_HEIGHT)
+			vy[i] = py <= 0 ? -fabsf(vy[i]) : fabsf(vy[i]);
+	}
+}
+
+// BenchCollide: checks the grid against every pair on a few thousand points, then times a step of
+// 10^5 points on 1, 2, 4, ... threads
+void BenchCollide(int threads)
+{
+	const int small = 4000;
+	const int len = 100000;
+	const int steps = 10;
+
+	// NOTE (Brian) 10^5 discs of radius 1 cover about a third of the frame, at 4 they'd cover it five
+	// times over and it's just one big pile
+	if (!G_Collide)
+		G_Radius = 1.0f;
+
+	Point *points = malloc(len * sizeof(*points));
+	assert(points != NULL);
+	for (int i = 0; i < len; i++)
+		GenerateRandomPoint(points + i);
+
+	PointSet set;
+	PointSetInit(&set, small);
+	PointSetLoad(&set, points, 0, small);
+
+	float *vx = malloc(small * sizeof(*vx));
+	float *vy = malloc(small * sizeof(*vy));
+	int *partner = malloc(small * sizeof(*partner));
+	assert(vx != NULL && vy != NULL && partner != NULL);
+
+	double start = GetTime();
+	CollideBrute(&set, partner, vx, vy);
+	double brute = GetTime() - start;
+
+	PoolStart(1);
+	CollideInit(1, small);
+
+	CollideBenchJob job = { &set, 1 };
+	start = GetTime();
+	PoolRun(CollideBenchWork, &job);
+	double grid = GetTime() - start;
+
+	int differ = 0;
+	for (int i = 0; i < small; i++)
+		differ += collide_vx[i] != vx[i] || collide_vy[i] != vy[i];
+
+	printf("radius %.1f, %dx%d\n", G_Radius, G_WIDTH, G_HEIGHT);
+	printf("  Check         %d points, grid %.3fms, every pair %.3fms, %d velocities differ\n",
+		small, grid * 1000, brute * 1000, differ);
+
+	CollideFree();
+	PoolStop();
+	PointSetFree(&set);
+
+	double base = 0;
+
+	for (int n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+		PointSetInit(&set, len);
+		PointSetLoad(&set, points, 0, len);
+
+		PoolStart(n);
+		CollideInit(n, len);
+
+		job.steps = steps;
+		start = GetTime();
+		PoolRun(CollideBenchWork, &job);
+		double elapsed = (GetTime() - start) / steps;
+
+		if (n == 1)
+			base = elapsed;
+
+		long long touching = 0, bounced = 0;
+		for (int i = 0; i < n; i++) {
+			touching += collide_workers[i].touching;
+			bounced += collide_workers[i].bounced;
+		}
+
+		printf("  %3d threads  %d points  %9.3fms per step  %6.2fx  %.1f contacts and %.1f bounces per step\n", n,
+			len, elapsed * 1000, base / elapsed, (double)touching / steps, (double)bounced / 2 / steps);
+
+		CollideFree();
+		PoolStop();
+		PointSetFree(&set);
+
+		if (n == threads)
+			break;
+	}
+
+	free(partner);
+	free(vy);
+	free(vx);
+	free(points);
+}
@@ -0,0 +1,640 @@
+// Brian Chrzanowski
+// Barnes-Hut Forces
+//
+// With G_Force, every point pulls on every other one with G_Force / d^2, or pushes when it's
+// negative, and that goes into ax and ay for MovePoint to integrate. All of them at once is N^2, so
+// the points go in a quadtree instead, where every node knows how many points it holds and where
+// their center of mass is, and anything that looks smaller than G_Theta from a point (the side of the
+// node over the distance to its center of mass) counts as one big point.
+//
+// The tree is rebuilt every step by the whole pool. The bounding square gets cut into a grid of
+// FORCE_TOP_CELLS top cells, and the points get counting sorted into them the same way collide.c
+// sorts its grid. Then every worker builds the subtrees of its top cells in its own arena, the few
+// nodes above the top cells get filled in, and the subtrees are copied in after them. None of that
+// depends on which worker did what, so neither does the tree, and the forces come out the same on
+// any number of threads. Each worker then walks the tree for its share of the points, in tree order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+// the top cells are FORCE_TOP_CELLS x FORCE_TOP_CELLS, at depth FORCE_TOP of the tree
+#define FORCE_TOP 4
+#define FORCE_TOP_SIDE (1 << FORCE_TOP)
+#define FORCE_TOP_CELLS (FORCE_TOP_SIDE * FORCE_TOP_SIDE)
+
+// the nodes above the top cells, every level of them laid out row by row
+#define FORCE_TOP_NODES (((1 << (2 * FORCE_TOP)) - 1) / 3)
+
+// a node with this many points or fewer doesn't get split
+#define FORCE_LEAF 8
+
+// nor does one this deep, so a pile of points on top of each other still stops somewhere
+#define FORCE_MAX_DEPTH 24
+
+// NOTE (Brian) without some softening two points that land on top of each other fling each other out
+// of the frame, this is in pixels
+#define FORCE_SOFTENING 2.0f
+
+float G_Force;
+float G_Theta = 0.5f;
+
+typedef struct {
+	float x, y; // center of mass
+	float mass; // how many points
+	float size; // the side of the square it covers
+	float offset; // how far the center of mass is from the middle of the square
+	int child[4]; // -1 where there's nothing, all -1 on a leaf
+	int lo, hi; // its points in force_sx and force_sy
+} ForceNode;
+
+typedef struct {
+	ForceNode *nodes;
+	int len;
+	int cap;
+} ForceArena;
+
+typedef struct {
+	_Alignas(64) float x0, y0, x1, y1; // bounds of this worker's share of the points
+	ForceArena arena;
+	long long interactions;
+	long long steps;
+	double build_time;
+	double walk_time;
+} ForceWorker;
+
+static int force_points_len;
+static int force_workers_len;
+
+static float force_x0, force_y0, force_size; // the bounding square, for ForceTop
+
+static int *force_cell_of; // by point, its top cell
+static int *force_counts; // a row of FORCE_TOP_CELLS for every worker, then its offsets
+static int force_start[FORCE_TOP_CELLS + 1]; // the first point of every top cell, sorted
+static int force_local[FORCE_TOP_CELLS]; // where every top cell's subtree starts in its arena
+static int force_local_len[FORCE_TOP_CELLS]; // and how many nodes it has
+static int force_global[FORCE_TOP_CELLS]; // and where it starts in force_nodes, -1 when it's empty
+
+static int *force_sorted; // point indices, top cell by top cell, then leaf by leaf
+static float *force_sx; // their positions, in the same order
+static float *force_sy;
+
+static ForceNode *force_nodes;
+static int force_nodes_cap;
+
+static ForceWorker *force_workers;
+static void *force_alloc;
+
+// ForceInit: scratch space for points_len points on workers workers
+void ForceInit(int workers, int points_len)
+{
+	ForceFree();
+
+	force_points_len = points_len;
+	force_workers_len = workers;
+
+	force_cell_of = malloc(points_len * sizeof(*force_cell_of));
+	force_counts = malloc((size_t)workers * FORCE_TOP_CELLS * sizeof(*force_counts));
+	force_sorted = malloc(points_len * sizeof(*force_sorted));
+	force_sx = malloc(points_len * sizeof(*force_sx));
+	force_sy = malloc(points_len * sizeof(*force_sy));
+	force_alloc = calloc(workers + 1, sizeof(*force_workers));
+	assert(force_cell_of != NULL && force_counts != NULL && force_sorted != NULL);
+	assert(force_sx != NULL && force_sy != NULL && force_alloc != NULL);
+
+	force_workers = (ForceWorker *)(((uintptr_t)force_alloc + 63) & ~(uintptr_t)63);
+}
+
+void ForceFree()
+{
+	for (int i = 0; i < force_workers_len; i++)
+		free(force_workers[i].arena.nodes);
+
+	free(force_cell_of);
+	free(force_counts);
+	free(force_sorted);
+	free(force_sx);
+	free(force_sy);
+	free(force_nodes);
+	free(force_alloc);
+
+	force_cell_of = force_counts = force_sorted = NULL;
+	force_sx = force_sy = NULL;
+	force_nodes = NULL;
+	force_nodes_cap = 0;
+	force_workers = NULL;
+	force_alloc = NULL;
+	force_workers_len = 0;
+}
+
+// ForceTopCell: the top cell a position falls in, in the bounding square at (x0, y0)
+static int ForceTopCell(float x, float y, float x0, float y0, float size)
+{
+	int col = (int)((x - x0) / size * FORCE_TOP_SIDE);
+	int row = (int)((y - y0) / size * FORCE_TOP_SIDE);
+
+	// NOTE (Brian) the far edges of the bounding square land one past the last cell
+	col = col < 0 ? 0 : col >= FORCE_TOP_SIDE ? FORCE_TOP_SIDE - 1 : col;
+	row = row < 0 ? 0 : row >= FORCE_TOP_SIDE ? FORCE_TOP_SIDE - 1 : row;
+
+	return col + FORCE_TOP_SIDE * row;
+}
+
+static int ForceNewNode(ForceArena *arena)
+{
+	if (arena->len == arena->cap) {
+		arena->cap = arena->cap ? arena->cap * 2 : 1024;
+		arena->nodes = realloc(arena->nodes, arena->cap * sizeof(*arena->nodes));
+		assert(arena->nodes != NULL);
+	}
+
+	return arena->len++;
+}
+
+static void ForceSwap(int a, int b)
+{
+	int i = force_sorted[a];
+	force_sorted[a] = force_sorted[b];
+	force_sorted[b] = i;
+
+	float f = force_sx[a];
+	force_sx[a] = force_sx[b];
+	force_sx[b] = f;
+
+	f = force_sy[a];
+	force_sy[a] = force_sy[b];
+	force_sy[b] = f;
+}
+
+// ForcePartition: moves the points in [lo, hi) with coordinate v below mid to the front, and
+// returns where the rest start
+static int ForcePartition(float *v, float mid, int lo, int hi)
+{
+	while (lo < hi) {
+		if (v[lo] < mid) {
+			lo++;
+		} else {
+			hi--;
+			ForceSwap(lo, hi);
+		}
+	}
+
+	return lo;
+}
+
+// ForceOffset: sets how far n's center of mass is from the middle of its square at (x0, y0)
+static void ForceOffset(ForceNode *n, float x0, float y0)
+{
+	n->offset = hypotf(n->x - (x0 + n->size / 2), n->y - (y0 + n->size / 2));
+}
+
+// ForceBuild: the subtree over points [lo, hi) in the square at (x0, y0), returns its index in arena
+static int ForceBuild(ForceArena *arena, int lo, int hi, float x0, float y0, float size, int depth)
+{
+	int node = ForceNewNode(arena);
+	ForceNode n = { .size = size, .child = { -1, -1, -1, -1 }, .lo = lo, .hi = hi };
+
+	if (hi - lo <= FORCE_LEAF || depth >= FORCE_MAX_DEPTH) {
+		float x = 0, y = 0;
+		for (int i = lo; i < hi; i++) {
+			x += force_sx[i];
+			y += force_sy[i];
+		}
+
+		n.mass = hi - lo;
+		n.x = x / n.mass;
+		n.y = y / n.mass;
+		ForceOffset(&n, x0, y0);
+		arena->nodes[node] = n;
+		return node;
+	}
+
+	float half = size / 2;
+	float mx = x0 + half, my = y0 + half;
+
+	// top half, then each half split into left and right, so the quadrants go in child order
+	int ymid = ForcePartition(force_sy, my, lo, hi);
+	int split[5] = { lo, ForcePartition(force_sx, mx, lo, ymid), ymid, ForcePartition(force_sx, mx, ymid, hi), hi };
+
+	float x = 0, y = 0;
+
+	for (int q = 0; q < 4; q++) {
+		if (split[q] == split[q + 1])
+			continue;
+
+		int child = ForceBuild(arena, split[q], split[q + 1], x0 + (q & 1) * half, y0 + (q >> 1) * half, half, depth + 1);
+		ForceNode *c = arena->nodes + child;
+
+		n.child[q] = child;
+		n.mass += c->mass;
+		x += c->x * c->mass;
+		y += c->y * c->mass;
+	}
+
+	n.x = x / n.mass;
+	n.y = y / n.mass;
+	ForceOffset(&n, x0, y0);
+	arena->nodes[node] = n;
+
+	return node;
+}
+
+// ForceTop: fills in the nodes above the top cells, from the bottom up
+static void ForceTop()
+{
+	for (int depth = FORCE_TOP - 1; depth >= 0; depth--) {
+		int side = 1 << depth;
+		int base = ((1 << (2 * depth)) - 1) / 3;
+		int below = ((1 << (2 * (depth + 1))) - 1) / 3;
+
+		for (int row = 0; row < side; row++) {
+			for (int col = 0; col < side; col++) {
+				ForceNode n = { .size = force_size / side, .child = { -1, -1, -1, -1 } };
+				float x = 0, y = 0;
+
+				for (int q = 0; q < 4; q++) {
+					int ccol = 2 * col + (q & 1), crow = 2 * row + (q >> 1);
+					int child = depth + 1 == FORCE_TOP ? force_global[ccol + FORCE_TOP_SIDE * crow]
+						: below + ccol + 2 * side * crow;
+
+					if (child < 0 || force_nodes[child].mass == 0)
+						continue;
+
+					ForceNode *c = force_nodes + child;
+					n.child[q] = child;
+					n.mass += c->mass;
+					x += c->x * c->mass;
+					y += c->y * c->mass;
+				}
+
+				if (n.mass > 0) {
+					n.x = x / n.mass;
+					n.y = y / n.mass;
+					ForceOffset(&n, force_x0 + col * n.size, force_y0 + row * n.size);
+				}
+
+				force_nodes[base + col + side * row] = n;
+			}
+		}
+	}
+}
+
+// ForceWalk: the acceleration on the point at (px, py), and how many nodes and points it took
+static int ForceWalk(float px, float py, float *ax, float *ay)
+{
+	int stack[4 * (FORCE_TOP + FORCE_MAX_DEPTH) + 4];
+	int top = 0;
+	int interactions = 0;
+	float theta2 = G_Theta * G_Theta;
+	float soft = FORCE_SOFTENING * FORCE_SOFTENING;
+	float fx = 0, fy = 0;
+
+	stack[top++] = 0;
+
+	while (top > 0) {
+		ForceNode *n = force_nodes + stack[--top];
+		if (n->mass == 0)
+			continue;
+
+		float dx = n->x - px;
+		float dy = n->y - py;
+		float d2 = dx * dx + dy * dy;
+
+		bool leaf = n->child[0] < 0 && n->child[1] < 0 && n->child[2] < 0 && n->child[3] < 0;
+
+		// NOTE (Brian) the point itself is 0 away, and with the softening that adds exactly 0
+		if (leaf) {
+			for (int k = n->lo; k < n->hi; k++) {
+				float ex = force_sx[k] - px;
+				float ey = force_sy[k] - py;
+				float r2 = ex * ex + ey * ey + soft;
+				float inv = 1.0f / (r2 * sqrtf(r2));
+				fx += ex * inv;
+				fy += ey * inv;
+			}
+			interactions += n->hi - n->lo;
+			continue;
+		}
+
+		// Barnes' criterion, with the distance cut by how far the center of mass is off center, so a
+		// point right next to a lopsided node still opens it
+		float near = sqrtf(d2) - n->offset;
+
+		if (near > 0 && n->size * n->size < theta2 * near * near) {
+			float r2 = d2 + soft;
+			float inv = n->mass / (r2 * sqrtf(r2));
+			fx += dx * inv;
+			fy += dy * inv;
+			interactions++;
+		} else {
+			for (int q = 3; q >= 0; q--) {
+				if (n->child[q] >= 0)
+					stack[top++] = n->child[q];
+			}
+		}
+	}
+
+	*ax = G_Force * fx;
+	*ay = G_Force * fy;
+
+	return interactions;
+}
+
+// ForceStep: called by every worker of a pool job, sets ax and ay on all of the points of set from
+// where all the others are, MovePoint or PointSetStep still has to move them afterwards
+void ForceStep(PointSet *set, int worker, int workers)
+{
+	assert(workers == force_workers_len && set->len == force_points_len);
+
+	ForceWorker *self = force_workers + worker;
+	double start = GetTime();
+
+	int lo = (int)((int64_t)set->len * worker / workers);
+	int hi = (int)((int64_t)set->len * (worker + 1) / workers);
+
+	float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+	for (int i = lo; i < hi; i++) {
+		x0 = fminf(x0, set->px[i]);
+		y0 = fminf(y0, set->py[i]);
+		x1 = fmaxf(x1, set->px[i]);
+		y1 = fmaxf(y1, set->py[i]);
+	}
+	self->x0 = x0;
+	self->y0 = y0;
+	self->x1 = x1;
+	self->y1 = y1;
+
+	PoolBarrier(worker);
+
+	// everyone works out the same bounding square
+	for (int w = 0; w < workers; w++) {
+		x0 = fminf(x0, force_workers[w].x0);
+		y0 = fminf(y0, force_workers[w].y0);
+		x1 = fmaxf(x1, force_workers[w].x1);
+		y1 = fmaxf(y1, force_workers[w].y1);
+	}
+	float size = fmaxf(fmaxf(x1 - x0, y1 - y0), 1.0f);
+
+	if (worker == 0) {
+		force_x0 = x0;
+		force_y0 = y0;
+		force_size = size;
+	}
+
+	int *counts = force_counts + (size_t)worker * FORCE_TOP_CELLS;
+	memset(counts, 0, FORCE_TOP_CELLS * sizeof(*counts));
+	for (int i = lo; i < hi; i++) {
+		int cell = ForceTopCell(set->px[i], set->py[i], x0, y0, size);
+		force_cell_of[i] = cell;
+		counts[cell]++;
+	}
+
+	PoolBarrier(worker);
+
+	// NOTE (Brian) there aren't enough top cells for this to be worth splitting up
+	if (worker == 0) {
+		int offset = 0;
+		for (int c = 0; c < FORCE_TOP_CELLS; c++) {
+			force_start[c] = offset;
+			for (int w = 0; w < workers; w++) {
+				int *slot = force_counts + (size_t)w * FORCE_TOP_CELLS + c;
+				int n = *slot;
+				*slot = offset;
+				offset += n;
+			}
+		}
+		force_start[FORCE_TOP_CELLS] = offset;
+	}
+
+	PoolBarrier(worker);
+
+	for (int i = lo; i < hi; i++) {
+		int k = counts[force_cell_of[i]]++;
+		force_sorted[k] = i;
+		force_sx[k] = set->px[i];
+		force_sy[k] = set->py[i];
+	}
+
+	PoolBarrier(worker);
+
+	ForceArena *arena = &self->arena;
+	arena->len = 0;
+
+	float cell = size / FORCE_TOP_SIDE;
+	for (int c = worker; c < FORCE_TOP_CELLS; c += workers) {
+		force_local[c] = arena->len;
+		if (force_start[c] < force_start[c + 1]) {
+			ForceBuild(arena, force_start[c], force_start[c + 1], x0 + (c % FORCE_TOP_SIDE) * cell,
+				y0 + (c / FORCE_TOP_SIDE) * cell, cell, FORCE_TOP);
+		}
+		force_local_len[c] = arena->len - force_local[c];
+	}
+
+	PoolBarrier(worker);
+
+	if (worker == 0) {
+		int offset = FORCE_TOP_NODES;
+		for (int c = 0; c < FORCE_TOP_CELLS; c++) {
+			force_global[c] = force_local_len[c] > 0 ? offset : -1;
+			offset += force_local_len[c];
+		}
+
+		if (force_nodes_cap < offset) {
+			free(force_nodes);
+			force_nodes_cap = offset * 2;
+			force_nodes = malloc(force_nodes_cap * sizeof(*force_nodes));
+			assert(force_nodes != NULL);
+		}
+	}
+
+	PoolBarrier(worker);
+
+	// every subtree moves over as a block, so its children all move by the same amount
+	for (int c = worker; c < FORCE_TOP_CELLS; c += workers) {
+		if (force_global[c] < 0)
+			continue;
+
+		int shift = force_global[c] - force_local[c];
+		ForceNode *to = force_nodes + force_global[c];
+		ForceNode *from = arena->nodes + force_local[c];
+
+		for (int k = 0; k < force_local_len[c]; k++) {
+			to[k] = from[k];
+			for (int q = 0; q < 4; q++) {
+				if (to[k].child[q] >= 0)
+					to[k].child[q] += shift;
+			}
+		}
+	}
+
+	PoolBarrier(worker);
+
+	if (worker == 0)
+		ForceTop();
+
+	PoolBarrier(worker);
+
+	double built = GetTime();
+	self->build_time += built - start;
+
+	// NOTE (Brian) going in tree order, the next point walks mostly the same nodes as the last one, so
+	// they're still in cache, but then the accelerations land in everyone's share
+	long long interactions = 0;
+	for (int k = lo; k < hi; k++) {
+		int i = force_sorted[k];
+		interactions += ForceWalk(force_sx[k], force_sy[k], set->ax + i, set->ay + i);
+	}
+
+	PoolBarrier(worker);
+
+	self->interactions += interactions;
+	self->walk_time += GetTime() - built;
+	self->steps++;
+}
+
+// ForceReport: interactions and time per step since the last report
+void ForceReport()
+{
+	if (force_workers_len == 0 || force_workers[0].steps == 0)
+		return;
+
+	long long interactions = 0;
+	for (int i = 0; i < force_workers_len; i++) {
+		interactions += force_workers[i].interactions;
+		force_workers[i].interactions = 0;
+	}
+
+	ForceWorker *w = force_workers;
+	printf("  Forces        theta %.2f, %.1f interactions per point, tree %.3fms walk %.3fms per step\n",
+		G_Theta, (double)interactions / force_points_len / w->steps,
+		w->build_time * 1000 / w->steps, w->walk_time * 1000 / w->steps);
+
+	w->steps = 0;
+	w->build_time = 0;
+	w->walk_time = 0;
+}
+
+static void ForceBenchWork(void *arg, int worker, int workers)
+{
+	PointSet *set = arg;
+	ForceStep(set, worker, workers);
+}
+
+// BenchForce: the tree against summing over every point, for a few thetas, then a step of 10^5
+// points on 1, 2, 4, ... threads
+void BenchForce(int threads)
+{
+	const int len = 100000;
+	const int sample = 500;
+	const int steps = 5;
+	float thetas[] = { 0.3f, 0.5f, 0.7f, 1.0f };
+
+	Point *points = malloc(len * sizeof(*points));
+	float *exact = malloc(2 * sample * sizeof(*exact));
+	assert(points != NULL && exact != NULL);
+
+	for (int i = 0; i < len; i++)
+		GenerateRandomPoint(points + i);
+
+	if (G_Force == 0)
+		G_Force = 1.0f;
+
+	PointSet set;
+	PointSetInit(&set, len);
+	PointSetLoad(&set, points, 0, len);
+
+	// every len / sample'th point, summed over every point, in doubles
+	double start = GetTime();
+	for (int s = 0; s < sample; s++) {
+		int i = (int)((int64_t)s * len / sample);
+		double fx = 0, fy = 0;
+
+		for (int j = 0; j < len; j++) {
+			if (j == i)
+				continue;
+			double ex = set.px[j] - set.px[i];
+			double ey = set.py[j] - set.py[i];
+			double r2 = ex * ex + ey * ey + FORCE_SOFTENING * FORCE_SOFTENING;
+			double inv = 1 / (r2 * sqrt(r2));
+			fx += ex * inv;
+			fy += ey * inv;
+		}
+
+		exact[2 * s] = G_Force * fx;
+		exact[2 * s + 1] = G_Force * fy;
+	}
+	double direct = (GetTime() - start) / sample * len;
+
+	printf("%d points, force %g, %dx%d\n", len, G_Force, G_WIDTH, G_HEIGHT);
+	printf("  Direct        %9.3fms per step (estimated from %d points)\n", direct * 1000, sample);
+
+	float theta = G_Theta;
+
+	PoolStart(1);
+	ForceInit(1, len);
+
+	for (int t = 0; t < (int)(sizeof(thetas) / sizeof(*thetas)); t++) {
+		G_Theta = thetas[t];
+
+		start = GetTime();
+		PoolRun(ForceBenchWork, &set);
+		double elapsed = GetTime() - start;
+
+		double err2 = 0, max = 0;
+		for (int s = 0; s < sample; s++) {
+			int i = (int)((int64_t)s * len / sample);
+			double ex = set.ax[i] - exact[2 * s];
+			double ey = set.ay[i] - exact[2 * s + 1];
+			double e = sqrt((ex * ex + ey * ey) / (exact[2 * s] * exact[2 * s] + exact[2 * s + 1] * exact[2 * s + 1]));
+			err2 += e * e;
+			if (max < e)
+				max = e;
+		}
+
+		long long interactions = force_workers[0].interactions;
+		force_workers[0].interactions = 0;
+
+		printf("  Theta %.2f    %9.3fms per step  %7.1fx  %6.1f interactions per point  error %.2e rms %.2e max\n",
+			G_Theta, elapsed * 1000, direct / elapsed, (double)interactions / len, sqrt(err2 / sample), max);
+	}
+
+	ForceFree();
+	PoolStop();
+
+	G_Theta = theta;
+	double base = 0;
+
+	for (int n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+		PoolStart(n);
+		ForceInit(n, len);
+
+		PoolRun(ForceBenchWork, &set);
+
+		start = GetTime();
+		for (int s = 0; s < steps; s++)
+			PoolRun(ForceBenchWork, &set);
+		double elapsed = (GetTime() - start) / steps;
+
+		if (n == 1)
+			base = elapsed;
+
+		ForceWorker *w = force_workers;
+		printf("  %3d threads  theta %.2f  %9.3fms per step  %6.2fx  (tree %.3fms walk %.3fms)\n", n, G_Theta,
+			elapsed * 1000, base / elapsed, w->build_time * 1000 / w->steps, w->walk_time * 1000 / w->steps);
+
+		ForceFree();
+		PoolStop();
+
+		if (n == threads)
+			break;
+	}
+
+	PointSetFree(&set);
+	free(exact);
+	free(points);
+}
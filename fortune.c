@@ -0,0 +1,855 @@
+// Brian Chrzanowski
+// Fortune's Sweepline Voronoi Engine
+//
+// Instead of deciding ownership per pixel, this builds the actual Voronoi diagram of the points
+// with Fortune's sweepline algorithm in O(N log N), turns every cell into a convex polygon clipped
+// to the frame, and scan converts the polygons into the frame. The same polygons can be written out
+// as an SVG.
+//
+// The sweep moves down the frame (increasing y). The beach line is a doubly linked list of arcs,
+// with a treap over the same arcs so finding the arc above a new site is O(log N). Every pair of
+// arcs that is ever adjacent on the beach line are Voronoi neighbors, which is all we keep from
+// the sweep. Each cell is then the frame rectangle cut down by the bisectors with its neighbors.
+//
+// Polygon edges are computed in doubles, so pixels within a pixel of a cell's edge are picked
+// exactly, against the cell's neighbors, the same way UpdatePixelForPoints picks. The cells are
+// bucketed by FORTUNE_BAND row bands, so a tile only looks at the cells in the bands it covers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+#define FORTUNE_BAND 16
+
+typedef struct Arc {
+	int site;
+	int event; // circle event that will remove this arc, -1 if there isn't one
+	uint32_t priority;
+	struct Arc *prev, *next;
+	struct Arc *left, *right, *parent;
+} Arc;
+
+typedef struct {
+	double x, y;
+	Arc *arc;
+	bool valid;
+} Event;
+
+typedef struct {
+	double x, y;
+} Vertex;
+
+// SiteKey: a site's place in the sweep, sorted on its own so qsort doesn't need the points
+typedef struct {
+	float y, x;
+	int site;
+} SiteKey;
+
+// Fortune: everything one build of the diagram needs. The engine keeps its own, and WriteSVG makes
+// another one, because it runs on the sink thread while the engine is already on the next frame.
+typedef struct {
+	Point *points;
+	int points_len;
+	int cap;
+
+	SiteKey *order; // sites sorted by y, then x, then index
+	bool *dropped; // duplicates of another site, they never own anything
+
+	Arc *arcs; // pool, every site adds at most two arcs
+	int arcs_len;
+	Arc *root;
+	uint32_t rng;
+
+	Event *events;
+	int events_len;
+	int events_cap;
+	int *heap;
+	int heap_len;
+	int heap_cap;
+
+	int *pairs; // neighbor pairs found by the sweep, two ints each
+	int pairs_len;
+	int pairs_cap;
+
+	int *adj_start; // neighbors of site i are adj[adj_start[i]..[i + 1]]
+	int *adj;
+
+	Vertex *verts; // cell polygons, site i is verts[cell_start[i]..[i + 1]]
+	int verts_len;
+	int verts_cap;
+	int *cell_start;
+	float *bounds; // ymin, ymax, xmin, xmax per cell
+} Fortune;
+
+static Label *fortune_labels;
+static Fortune fortune_engine;
+
+static int *fortune_band_start; // cells touching band b are fortune_band_cells[start[b]..[b + 1]]
+static int *fortune_band_cells;
+static int fortune_bands_cap;
+static int fortune_band_cells_cap;
+
+static void *FortuneGrow(void *p, int *cap, int need, size_t size)
+{
+	if (*cap >= need)
+		return p;
+	while (*cap < need)
+		*cap = *cap ? *cap * 2 : 64;
+	p = realloc(p, *cap * size);
+	assert(p != NULL);
+	return p;
+}
+
+static int FortuneSiteCompare(const void *a, const void *b)
+{
+	const SiteKey *ka = a;
+	const SiteKey *kb = b;
+
+	if (ka->y != kb->y)
+		return ka->y < kb->y ? -1 : 1;
+	if (ka->x != kb->x)
+		return ka->x < kb->x ? -1 : 1;
+	return ka->site - kb->site;
+}
+
+// Breakpoint: x where the arc of site p (on the left) meets the arc of site q, with the sweep at l
+static double Breakpoint(Fortune *f, int p, int q, double l)
+{
+	double px = f->points[p].px, py = f->points[p].py;
+	double qx = f->points[q].px, qy = f->points[q].py;
+
+	// a site on the sweep line is still a vertical ray
+	if (py == l && qy == l)
+		return (px + qx) / 2;
+	if (py == l)
+		return px;
+	if (qy == l)
+		return qx;
+
+	// the difference of the two parabolas, multiplied through by both denominators
+	double dp = 2 * (py - l);
+	double dq = 2 * (qy - l);
+	double a = dq - dp;
+	double b = 2 * (qx * dp - px * dq);
+	double c = (px * px + py * py - l * l) * dq - (qx * qx + qy * qy - l * l) * dp;
+
+	if (a == 0)
+		return -c / b;
+
+	// the root where p stops being on top is (-b - sqrt(disc)) / 2a, written so it doesn't cancel
+	double disc = sqrt(fmax(b * b - 4 * a * c, 0));
+	if (b >= 0)
+		return (-b - disc) / (2 * a);
+	return (2 * c) / (-b + disc);
+}
+
+static void TreapRotateUp(Fortune *f, Arc *n)
+{
+	Arc *p = n->parent;
+	Arc *g = p->parent;
+
+	if (p->left == n) {
+		p->left = n->right;
+		if (n->right)
+			n->right->parent = p;
+		n->right = p;
+	} else {
+		p->right = n->left;
+		if (n->left)
+			n->left->parent = p;
+		n->left = p;
+	}
+
+	p->parent = n;
+	n->parent = g;
+
+	if (g == NULL)
+		f->root = n;
+	else if (g->left == p)
+		g->left = n;
+	else
+		g->right = n;
+}
+
+static Arc *NewArc(Fortune *f, int site)
+{
+	Arc *arc = f->arcs + f->arcs_len++;
+
+	memset(arc, 0, sizeof(*arc));
+	arc->site = site;
+	arc->event = -1;
+
+	// xorshift, the priorities only need to look random
+	f->rng ^= f->rng << 13;
+	f->rng ^= f->rng >> 17;
+	f->rng ^= f->rng << 5;
+	arc->priority = f->rng;
+
+	return arc;
+}
+
+// InsertArc: puts n right after a on the beach line, or right before it if before is set
+static void InsertArc(Fortune *f, Arc *a, Arc *n, bool before)
+{
+	if (before) {
+		n->next = a;
+		n->prev = a->prev;
+		if (a->prev)
+			a->prev->next = n;
+		a->prev = n;
+
+		if (a->left == NULL) {
+			a->left = n;
+			n->parent = a;
+		} else {
+			Arc *s = a->left;
+			while (s->right)
+				s = s->right;
+			s->right = n;
+			n->parent = s;
+		}
+	} else {
+		n->prev = a;
+		n->next = a->next;
+		if (a->next)
+			a->next->prev = n;
+		a->next = n;
+
+		if (a->right == NULL) {
+			a->right = n;
+			n->parent = a;
+		} else {
+			Arc *s = a->right;
+			while (s->left)
+				s = s->left;
+			s->left = n;
+			n->parent = s;
+		}
+	}
+
+	while (n->parent && n->parent->priority < n->priority)
+		TreapRotateUp(f, n);
+}
+
+static void RemoveArc(Fortune *f, Arc *n)
+{
+	while (n->left || n->right) {
+		Arc *c;
+		if (n->left == NULL)
+			c = n->right;
+		else if (n->right == NULL)
+			c = n->left;
+		else
+			c = n->left->priority > n->right->priority ? n->left : n->right;
+		TreapRotateUp(f, c);
+	}
+
+	if (n->parent == NULL)
+		f->root = NULL;
+	else if (n->parent->left == n)
+		n->parent->left = NULL;
+	else
+		n->parent->right = NULL;
+
+	if (n->prev)
+		n->prev->next = n->next;
+	if (n->next)
+		n->next->prev = n->prev;
+}
+
+// FindArc: the arc directly above x with the sweep at l
+static Arc *FindArc(Fortune *f, double x, double l)
+{
+	Arc *a = f->root;
+
+	for (;;) {
+		if (a->prev && x < Breakpoint(f, a->prev->site, a->site, l) && a->left) {
+			a = a->left;
+		} else if (a->next && x > Breakpoint(f, a->site, a->next->site, l) && a->right) {
+			a = a->right;
+		} else {
+			return a;
+		}
+	}
+}
+
+static bool EventBefore(Fortune *f, int a, int b)
+{
+	Event *ea = f->events + a;
+	Event *eb = f->events + b;
+	return ea->y < eb->y || (ea->y == eb->y && ea->x < eb->x);
+}
+
+static void HeapPush(Fortune *f, int e)
+{
+	f->heap = FortuneGrow(f->heap, &f->heap_cap, f->heap_len + 1, sizeof(*f->heap));
+
+	int i = f->heap_len++;
+	while (i > 0 && EventBefore(f, e, f->heap[(i - 1) / 2])) {
+		f->heap[i] = f->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	f->heap[i] = e;
+}
+
+static int HeapPop(Fortune *f)
+{
+	int top = f->heap[0];
+	int last = f->heap[--f->heap_len];
+	int i = 0;
+
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= f->heap_len)
+			break;
+		if (c + 1 < f->heap_len && EventBefore(f, f->heap[c + 1], f->heap[c]))
+			c++;
+		if (!EventBefore(f, f->heap[c], last))
+			break;
+		f->heap[i] = f->heap[c];
+		i = c;
+	}
+
+	if (f->heap_len > 0)
+		f->heap[i] = last;
+
+	return top;
+}
+
+static void AddPair(Fortune *f, int a, int b)
+{
+	f->pairs = FortuneGrow(f->pairs, &f->pairs_cap, f->pairs_len + 2, sizeof(*f->pairs));
+	f->pairs[f->pairs_len++] = a;
+	f->pairs[f->pairs_len++] = b;
+}
+
+static void CancelEvent(Fortune *f, Arc *arc)
+{
+	if (arc->event >= 0) {
+		f->events[arc->event].valid = false;
+		arc->event = -1;
+	}
+}
+
+// CheckCircle: if the breakpoints on either side of m are converging, m gets squeezed out when the
+// sweep reaches the bottom of the circle through the three sites
+static void CheckCircle(Fortune *f, Arc *m)
+{
+	Arc *l = m->prev;
+	Arc *r = m->next;
+
+	if (l == NULL || r == NULL || l->site == r->site)
+		return;
+
+	Point *a = f->points + l->site;
+	Point *b = f->points + m->site;
+	Point *c = f->points + r->site;
+
+	double bx = (double)b->px - a->px, by = (double)b->py - a->py;
+	double cx = (double)c->px - a->px, cy = (double)c->py - a->py;
+	double d = bx * cy - by * cx;
+
+	if (d <= 0)
+		return;
+
+	double b2 = bx * bx + by * by;
+	double c2 = cx * cx + cy * cy;
+	double ux = (cy * b2 - by * c2) / (2 * d);
+	double uy = (bx * c2 - cx * b2) / (2 * d);
+
+	f->events = FortuneGrow(f->events, &f->events_cap, f->events_len + 1, sizeof(*f->events));
+
+	Event *e = f->events + f->events_len;
+	e->x = a->px + ux;
+	e->y = a->py + uy + sqrt(ux * ux + uy * uy);
+	e->arc = m;
+	e->valid = true;
+
+	m->event = f->events_len++;
+	HeapPush(f, m->event);
+}
+
+static void SiteEvent(Fortune *f, int site)
+{
+	Point *p = f->points + site;
+	Arc *n = NewArc(f, site);
+
+	if (f->root == NULL) {
+		f->root = n;
+		return;
+	}
+
+	Arc *a = FindArc(f, p->px, p->py);
+
+	// the first row of sites are all still vertical rays, they just sit next to each other
+	if (f->points[a->site].py == p->py) {
+		InsertArc(f, a, n, p->px < f->points[a->site].px);
+		AddPair(f, a->site, site);
+		return;
+	}
+
+	CancelEvent(f, a);
+
+	// a gets split in two, with the new arc in the middle
+	Arc *a2 = NewArc(f, a->site);
+	InsertArc(f, a, n, false);
+	InsertArc(f, n, a2, false);
+	AddPair(f, a->site, site);
+
+	CheckCircle(f, a);
+	CheckCircle(f, a2);
+}
+
+static void CircleEvent(Fortune *f, Event *e)
+{
+	Arc *m = e->arc;
+	Arc *l = m->prev;
+	Arc *r = m->next;
+
+	AddPair(f, l->site, r->site);
+
+	CancelEvent(f, l);
+	CancelEvent(f, r);
+	RemoveArc(f, m);
+
+	CheckCircle(f, l);
+	CheckCircle(f, r);
+}
+
+// FortuneNeighbors: runs the sweep and fills in the neighbor lists
+static void FortuneNeighbors(Fortune *f)
+{
+	int n = f->points_len;
+
+	for (int i = 0; i < n; i++)
+		f->order[i] = (SiteKey){ f->points[i].py, f->points[i].px, i };
+	qsort(f->order, n, sizeof(*f->order), FortuneSiteCompare);
+
+	f->root = NULL;
+	f->arcs_len = 0;
+	f->events_len = 0;
+	f->heap_len = 0;
+	f->pairs_len = 0;
+	f->rng = 0x9e3779b9;
+
+	int next = 0;
+	while (next < n || f->heap_len > 0) {
+		if (f->heap_len > 0 && (next >= n || f->events[f->heap[0]].y <= f->order[next].y)) {
+			Event *e = f->events + HeapPop(f);
+			if (e->valid)
+				CircleEvent(f, e);
+			continue;
+		}
+
+		int site = f->order[next++].site;
+
+		// NOTE (Brian) two points in exactly the same spot, brute force always gives it to the lower
+		// index, and the sort put that one first, so the other one just doesn't get a cell
+		f->dropped[site] = false;
+		if (next >= 2) {
+			Point *prev = f->points + f->order[next - 2].site;
+			if (prev->px == f->points[site].px && prev->py == f->points[site].py) {
+				f->dropped[site] = true;
+				continue;
+			}
+		}
+
+		SiteEvent(f, site);
+	}
+
+	// pairs to sorted adjacency lists, duplicates removed
+	memset(f->adj_start, 0, (n + 1) * sizeof(*f->adj_start));
+	for (int i = 0; i < f->pairs_len; i++)
+		f->adj_start[f->pairs[i] + 1]++;
+	for (int i = 0; i < n; i++)
+		f->adj_start[i + 1] += f->adj_start[i];
+
+	f->adj = realloc(f->adj, (f->pairs_len + 1) * sizeof(*f->adj));
+	assert(f->adj != NULL);
+
+	for (int i = 0; i < f->pairs_len; i += 2) {
+		f->adj[f->adj_start[f->pairs[i]]++] = f->pairs[i + 1];
+		f->adj[f->adj_start[f->pairs[i + 1]]++] = f->pairs[i];
+	}
+
+	memmove(f->adj_start + 1, f->adj_start, n * sizeof(*f->adj_start));
+	f->adj_start[0] = 0;
+
+	int out = 0;
+	for (int i = 0; i < n; i++) {
+		int lo = f->adj_start[i], hi = f->adj_start[i + 1];
+
+		// cells only have about 6 neighbors, insertion sort is plenty
+		for (int j = lo + 1; j < hi; j++) {
+			int v = f->adj[j], k = j;
+			for (; k > lo && f->adj[k - 1] > v; k--)
+				f->adj[k] = f->adj[k - 1];
+			f->adj[k] = v;
+		}
+
+		f->adj_start[i] = out;
+		for (int j = lo; j < hi; j++) {
+			if (j == lo || f->adj[j] != f->adj[j - 1])
+				f->adj[out++] = f->adj[j];
+		}
+	}
+	f->adj_start[n] = out;
+}
+
+// ClipPolygon: keeps the part of poly where n . v <= d
+static int ClipPolygon(Vertex *out, Vertex *poly, int len, double nx, double ny, double d)
+{
+	int out_len = 0;
+
+	for (int i = 0; i < len; i++) {
+		Vertex *a = poly + i;
+		Vertex *b = poly + (i + 1) % len;
+		double da = nx * a->x + ny * a->y - d;
+		double db = nx * b->x + ny * b->y - d;
+
+		if (da <= 0)
+			out[out_len++] = *a;
+
+		if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+			double t = da / (da - db);
+			out[out_len].x = a->x + t * (b->x - a->x);
+			out[out_len].y = a->y + t * (b->y - a->y);
+			out_len++;
+		}
+	}
+
+	return out_len;
+}
+
+// FortuneCells: builds every cell's polygon from its neighbors
+static void FortuneCells(Fortune *f)
+{
+	int n = f->points_len;
+	int maxdeg = 0;
+
+	for (int i = 0; i < n; i++) {
+		int deg = f->adj_start[i + 1] - f->adj_start[i];
+		if (maxdeg < deg)
+			maxdeg = deg;
+	}
+
+	// every cut can add at most one vertex
+	Vertex *a = malloc((maxdeg + 4) * sizeof(*a));
+	Vertex *b = malloc((maxdeg + 4) * sizeof(*b));
+	assert(a != NULL && b != NULL);
+
+	f->verts_len = 0;
+
+	for (int i = 0; i < n; i++) {
+		double sx = f->points[i].px, sy = f->points[i].py;
+		int len = 0;
+
+		f->cell_start[i] = f->verts_len;
+
+		if (f->dropped[i])
+			continue;
+
+		a[len++] = (Vertex){ 0, 0 };
+		a[len++] = (Vertex){ G_WIDTH, 0 };
+		a[len++] = (Vertex){ G_WIDTH, G_HEIGHT };
+		a[len++] = (Vertex){ 0, G_HEIGHT };
+
+		for (int j = f->adj_start[i]; j < f->adj_start[i + 1] && len > 0; j++) {
+			double ox = f->points[f->adj[j]].px, oy = f->points[f->adj[j]].py;
+			len = ClipPolygon(b, a, len, ox - sx, oy - sy, ((ox * ox + oy * oy) - (sx * sx + sy * sy)) / 2);
+			Vertex *tmp = a;
+			a = b;
+			b = tmp;
+		}
+
+		if (len < 3)
+			continue;
+
+		f->verts = FortuneGrow(f->verts, &f->verts_cap, f->verts_len + len, sizeof(*f->verts));
+		memcpy(f->verts + f->verts_len, a, len * sizeof(*a));
+		f->verts_len += len;
+
+		float *bounds = f->bounds + 4 * i;
+		bounds[0] = bounds[2] = FLT_MAX;
+		bounds[1] = bounds[3] = -FLT_MAX;
+		for (int k = 0; k < len; k++) {
+			bounds[0] = fminf(bounds[0], a[k].y);
+			bounds[1] = fmaxf(bounds[1], a[k].y);
+			bounds[2] = fminf(bounds[2], a[k].x);
+			bounds[3] = fmaxf(bounds[3], a[k].x);
+		}
+	}
+
+	f->cell_start[n] = f->verts_len;
+
+	free(a);
+	free(b);
+}
+
+// FortuneBuild: computes the Voronoi cells of the points, clipped to the frame
+static void FortuneBuild(Fortune *f, Point *points, int points_len)
+{
+	f->points = points;
+	f->points_len = points_len;
+
+	if (f->cap < points_len) {
+		free(f->order);
+		free(f->dropped);
+		free(f->arcs);
+		free(f->adj_start);
+		free(f->cell_start);
+		free(f->bounds);
+		f->order = malloc(points_len * sizeof(*f->order));
+		f->dropped = malloc(points_len * sizeof(*f->dropped));
+		f->arcs = malloc(2 * points_len * sizeof(*f->arcs));
+		f->adj_start = malloc((points_len + 1) * sizeof(*f->adj_start));
+		f->cell_start = malloc((points_len + 1) * sizeof(*f->cell_start));
+		f->bounds = malloc(4 * points_len * sizeof(*f->bounds));
+		assert(f->order && f->dropped && f->arcs && f->adj_start && f->cell_start && f->bounds);
+		f->cap = points_len;
+	}
+
+	FortuneNeighbors(f);
+	FortuneCells(f);
+}
+
+// FortuneFree: everything a Fortune has allocated
+static void FortuneFree(Fortune *f)
+{
+	free(f->order);
+	free(f->dropped);
+	free(f->arcs);
+	free(f->events);
+	free(f->heap);
+	free(f->pairs);
+	free(f->adj_start);
+	free(f->adj);
+	free(f->verts);
+	free(f->cell_start);
+	free(f->bounds);
+	memset(f, 0, sizeof(*f));
+}
+
+// FortuneCellRows: the rows [*top, *bottom] cell i can write, false if it doesn't have any
+static bool FortuneCellRows(Fortune *f, int i, int *top, int *bottom)
+{
+	float *bounds = f->bounds + 4 * i;
+
+	if (f->cell_start[i + 1] - f->cell_start[i] < 3)
+		return false;
+
+	*top = (int)ceil(bounds[0] - 1);
+	*bottom = (int)floor(bounds[1] + 1);
+	if (*top < 0)
+		*top = 0;
+	if (*bottom >= G_HEIGHT)
+		*bottom = G_HEIGHT - 1;
+
+	return *top <= *bottom;
+}
+
+// FortuneBands: buckets the cells by the bands of rows they can write, in index order
+static void FortuneBands(Fortune *f)
+{
+	int bands = (G_HEIGHT + FORTUNE_BAND - 1) / FORTUNE_BAND;
+	int top, bottom;
+
+	if (fortune_bands_cap < bands) {
+		free(fortune_band_start);
+		fortune_band_start = malloc((bands + 1) * sizeof(*fortune_band_start));
+		assert(fortune_band_start != NULL);
+		fortune_bands_cap = bands;
+	}
+
+	memset(fortune_band_start, 0, (bands + 1) * sizeof(*fortune_band_start));
+	for (int i = 0; i < f->points_len; i++) {
+		if (!FortuneCellRows(f, i, &top, &bottom))
+			continue;
+		for (int b = top / FORTUNE_BAND; b <= bottom / FORTUNE_BAND; b++)
+			fortune_band_start[b + 1]++;
+	}
+
+	for (int b = 0; b < bands; b++)
+		fortune_band_start[b + 1] += fortune_band_start[b];
+
+	fortune_band_cells = FortuneGrow(fortune_band_cells, &fortune_band_cells_cap, fortune_band_start[bands], sizeof(*fortune_band_cells));
+
+	for (int i = 0; i < f->points_len; i++) {
+		if (!FortuneCellRows(f, i, &top, &bottom))
+			continue;
+		for (int b = top / FORTUNE_BAND; b <= bottom / FORTUNE_BAND; b++)
+			fortune_band_cells[fortune_band_start[b]++] = i;
+	}
+
+	for (int b = bands; b > 0; b--)
+		fortune_band_start[b] = fortune_band_start[b - 1];
+	fortune_band_start[0] = 0;
+}
+
+static int FortuneBegin(Label *labels, Point *points, int points_len)
+{
+	fortune_labels = labels;
+	FortuneBuild(&fortune_engine, points, points_len);
+	FortuneBands(&fortune_engine);
+	return 1;
+}
+
+// FortuneExact: picks between the cell's site and its neighbors like UpdatePixelForPoints, and only
+// writes the pixel if the cell's own site wins, whoever does win will write it from their own cell
+static void FortuneExact(Fortune *f, int site, int xa, int xb, int y)
+{
+	float y1 = y;
+
+	for (int x = xa; x < xb; x++) {
+		float x1 = x;
+		float xd = f->points[site].px - x1;
+		float yd = f->points[site].py - y1;
+		float min = xd * xd + yd * yd;
+		bool mine = true;
+
+		for (int j = f->adj_start[site]; j < f->adj_start[site + 1]; j++) {
+			int other = f->adj[j];
+			xd = f->points[other].px - x1;
+			yd = f->points[other].py - y1;
+			float currdist = xd * xd + yd * yd;
+			if (currdist < min || (currdist == min && other < site)) {
+				mine = false;
+				break;
+			}
+		}
+
+		if (mine)
+			fortune_labels[x + G_WIDTH * y] = (Label)site;
+	}
+}
+
+// CellSpan: where the horizontal line at y crosses the cell
+static void CellSpan(Vertex *poly, int len, double y, double *xl, double *xr)
+{
+	*xl = DBL_MAX;
+	*xr = -DBL_MAX;
+
+	for (int k = 0; k < len; k++) {
+		Vertex *a = poly + k;
+		Vertex *b = poly + (k + 1) % len;
+
+		if ((a->y <= y && y <= b->y) || (b->y <= y && y <= a->y)) {
+			double x = a->y == b->y ? a->x : a->x + (y - a->y) * (b->x - a->x) / (b->y - a->y);
+			double x2 = a->y == b->y ? b->x : x;
+			*xl = fmin(*xl, fmin(x, x2));
+			*xr = fmax(*xr, fmax(x, x2));
+		}
+	}
+}
+
+// FortuneFill: the rows [top, bottom] of cell i, inside [x0, x1)
+static void FortuneFill(Fortune *f, int i, int x0, int x1, int top, int bottom)
+{
+	Vertex *poly = f->verts + f->cell_start[i];
+	int len = f->cell_start[i + 1] - f->cell_start[i];
+	float *bounds = f->bounds + 4 * i;
+
+	for (int y = top; y <= bottom; y++) {
+		double xl, xr;
+		double sy = fmin(fmax(y, bounds[0]), bounds[1]);
+
+		CellSpan(poly, len, sy, &xl, &xr);
+		if (xl > xr)
+			continue;
+
+		// pixels within a pixel of the edge get picked exactly, including whole rows near the
+		// top and bottom of the cell, where an edge can be nearly horizontal
+		int el = (int)ceil(xl - 1), er = (int)floor(xr + 1);
+		int il = (int)ceil(xl + 1), ir = (int)floor(xr - 1);
+
+		if (y < bounds[0] + 1 || y > bounds[1] - 1)
+			il = er + 1;
+
+		if (el < x0)
+			el = x0;
+		if (er >= x1)
+			er = x1 - 1;
+		if (il < el)
+			il = el;
+		if (ir > er)
+			ir = er;
+
+		if (il > ir) {
+			FortuneExact(f, i, el, er + 1, y);
+		} else {
+			FortuneExact(f, i, el, il, y);
+			FillLabels(fortune_labels + (il + G_WIDTH * y), (Label)i, ir - il + 1);
+			FortuneExact(f, i, ir + 1, er + 1, y);
+		}
+	}
+}
+
+static void FortunePhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	Fortune *f = &fortune_engine;
+
+	// NOTE (Brian) a cell in more than one band only does the rows of each band inside that band
+	for (int b = y0 / FORTUNE_BAND; b * FORTUNE_BAND < y1; b++) {
+		int lo = b * FORTUNE_BAND > y0 ? b * FORTUNE_BAND : y0;
+		int hi = (b + 1) * FORTUNE_BAND < y1 ? (b + 1) * FORTUNE_BAND : y1;
+
+		for (int k = fortune_band_start[b]; k < fortune_band_start[b + 1]; k++) {
+			int i = fortune_band_cells[k];
+			float *bounds = f->bounds + 4 * i;
+			int top, bottom;
+
+			if (bounds[3] + 1 < x0 || bounds[2] - 1 >= x1)
+				continue;
+
+			FortuneCellRows(f, i, &top, &bottom);
+			if (top < lo)
+				top = lo;
+			if (bottom >= hi)
+				bottom = hi - 1;
+
+			FortuneFill(f, i, x0, x1, top, bottom);
+		}
+	}
+}
+
+Engine FortuneEngine = { "fortune", FortuneBegin, FortunePhase };
+
+// WriteSVG: writes the Voronoi cells of the points to file, returns -1 if it can't
+int WriteSVG(char *file, Point *points, int points_len)
+{
+	FILE *fp = fopen(file, "w");
+	if (fp == NULL)
+		return -1;
+
+	// NOTE (Brian) this is the sink thread, the engine's own build belongs to whatever frame the pool
+	// is drawing right now
+	Fortune f = { 0 };
+	FortuneBuild(&f, points, points_len);
+
+	fprintf(fp, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n",
+		G_WIDTH, G_HEIGHT, G_WIDTH, G_HEIGHT);
+
+	for (int i = 0; i < points_len; i++) {
+		int lo = f.cell_start[i], hi = f.cell_start[i + 1];
+		if (hi - lo < 3)
+			continue;
+
+		Pixel color = { .color = points[i].color };
+
+		fprintf(fp, "<polygon fill=\"#%02x%02x%02x\" points=\"", color.r, color.g, color.b);
+		for (int k = lo; k < hi; k++)
+			fprintf(fp, "%s%.3f,%.3f", k == lo ? "" : " ", f.verts[k].x, f.verts[k].y);
+		fprintf(fp, "\"/>\n");
+	}
+
+	fprintf(fp, "</svg>\n");
+
+	FortuneFree(&f);
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
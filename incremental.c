@@ -0,0 +1,415 @@
+// Brian Chrzanowski
+// Incremental Voronoi Engine
+//
+// Between timesteps every point only moves a few pixels, so most pixels keep the same owner. When a
+// pixel is picked, we also remember its INC_RIVALS runners up and how far away the next closest
+// point was. On later frames the owner and the runners up are just compared again, which is exact,
+// and the rest of the points can only have caught up if that next distance, less how far the points
+// near the pixel have moved since, has come down to the owner's distance. Those are the bands around
+// the corners of the cells near points that actually moved, everything else is a few distances.
+//
+// The frame is cut into INC_BLOCK square blocks. Every frame, each block finds the points that could
+// be closest to any of its pixels with a grid, the same way the tiles engine does with every point,
+// and how far each of those has moved. Pixels that do have to be picked again only look at those.
+// Where the points were is kept for the last INC_REFRESH frames, so a pixel that old is picked again
+// no matter what, and the whole frame is whenever the frame, the label buffer or the points change.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+#define INC_REFRESH 16
+#define INC_BLOCK 32
+#define INC_RIVALS 3
+
+// NOTE (Brian) distances come from float square roots, knock a little off so rounding can't make a
+// pixel look safer than it is
+#define INC_SLOP 0.01f
+
+#define INC_GRID_SLOP (1.0 + 1.0 / (1 << 20))
+
+typedef struct {
+	int *candidates; // every point that could be closest to one of the pixels, in index order
+	int candidates_len, candidates_cap;
+	float cutoff; // every other point is further than this from every pixel
+	float moved[INC_REFRESH]; // furthest a candidate got from where it was in that frame
+} IncBlock;
+
+static Label *inc_labels;
+static Point *inc_points;
+static int inc_points_len;
+
+static Label *inc_rivals; // INC_RIVALS runners up per pixel when it was picked
+static float *inc_next; // nothing else was closer than this when the pixel was picked
+static unsigned char *inc_picked_in; // frame the pixel was picked in, mod INC_REFRESH
+static size_t inc_len;
+
+static IncBlock *inc_blocks;
+static int inc_blocks_w, inc_blocks_h;
+
+static float *inc_hist_x; // where the points were, INC_REFRESH frames of them
+static float *inc_hist_y;
+static int inc_hist_cap;
+
+// points bucketed into a grid over the frame, points outside of it in the edge cells
+static int *inc_grid_start;
+static int *inc_grid_points;
+static int inc_grid_cap, inc_grid_points_cap;
+static int inc_grid_w, inc_grid_h;
+static float inc_grid_size;
+
+static int inc_frame;
+static int inc_now; // inc_frame mod INC_REFRESH
+static bool inc_full;
+
+static atomic_llong inc_picked;
+static atomic_llong inc_changed;
+static atomic_llong inc_candidates;
+static long long inc_pixels_total;
+static long long inc_blocks_total;
+
+static int IncGridCoord(double v, int cells)
+{
+	double c = floor(v / inc_grid_size);
+	if (c < 0)
+		return 0;
+	if (c >= cells)
+		return cells - 1;
+	return (int)c;
+}
+
+// IncGrid: counting sorts the points into the grid
+static void IncGrid(Point *points, int points_len)
+{
+	inc_grid_size = fmaxf(sqrtf((float)G_WIDTH * G_HEIGHT / points_len), 1);
+	inc_grid_w = (int)ceilf(G_WIDTH / inc_grid_size);
+	inc_grid_h = (int)ceilf(G_HEIGHT / inc_grid_size);
+
+	int cells = inc_grid_w * inc_grid_h;
+	if (inc_grid_cap < cells + 1) {
+		free(inc_grid_start);
+		inc_grid_start = malloc((cells + 1) * sizeof(*inc_grid_start));
+		assert(inc_grid_start != NULL);
+		inc_grid_cap = cells + 1;
+	}
+
+	if (inc_grid_points_cap < points_len) {
+		free(inc_grid_points);
+		inc_grid_points = malloc(points_len * sizeof(*inc_grid_points));
+		assert(inc_grid_points != NULL);
+		inc_grid_points_cap = points_len;
+	}
+
+	memset(inc_grid_start, 0, (cells + 1) * sizeof(*inc_grid_start));
+
+	for (int i = 0; i < points_len; i++) {
+		int c = IncGridCoord(points[i].px, inc_grid_w) + inc_grid_w * IncGridCoord(points[i].py, inc_grid_h);
+		inc_grid_start[c + 1]++;
+	}
+
+	for (int c = 0; c < cells; c++)
+		inc_grid_start[c + 1] += inc_grid_start[c];
+
+	for (int i = 0; i < points_len; i++) {
+		int c = IncGridCoord(points[i].px, inc_grid_w) + inc_grid_w * IncGridCoord(points[i].py, inc_grid_h);
+		inc_grid_points[inc_grid_start[c]++] = i;
+	}
+
+	memmove(inc_grid_start + 1, inc_grid_start, cells * sizeof(*inc_grid_start));
+	inc_grid_start[0] = 0;
+}
+
+static int IncBegin(Label *labels, Point *points, int points_len)
+{
+	size_t len = (size_t)G_WIDTH * G_HEIGHT;
+
+	inc_full = inc_len != len || inc_labels != labels || inc_points_len != points_len;
+
+	inc_labels = labels;
+	inc_points = points;
+	inc_points_len = points_len;
+
+	if (inc_len != len) {
+		for (int b = 0; b < inc_blocks_w * inc_blocks_h; b++)
+			free(inc_blocks[b].candidates);
+		free(inc_rivals);
+		free(inc_next);
+		free(inc_picked_in);
+		free(inc_blocks);
+		inc_blocks_w = (G_WIDTH + INC_BLOCK - 1) / INC_BLOCK;
+		inc_blocks_h = (G_HEIGHT + INC_BLOCK - 1) / INC_BLOCK;
+		inc_rivals = malloc(INC_RIVALS * len * sizeof(*inc_rivals));
+		inc_next = malloc(len * sizeof(*inc_next));
+		inc_picked_in = malloc(len * sizeof(*inc_picked_in));
+		inc_blocks = calloc(inc_blocks_w * inc_blocks_h, sizeof(*inc_blocks));
+		assert(inc_rivals != NULL && inc_next != NULL && inc_picked_in != NULL && inc_blocks != NULL);
+		inc_len = len;
+	}
+
+	if (inc_hist_cap < points_len) {
+		free(inc_hist_x);
+		free(inc_hist_y);
+		inc_hist_x = malloc(INC_REFRESH * points_len * sizeof(*inc_hist_x));
+		inc_hist_y = malloc(INC_REFRESH * points_len * sizeof(*inc_hist_y));
+		assert(inc_hist_x != NULL && inc_hist_y != NULL);
+		inc_hist_cap = points_len;
+	}
+
+	inc_now = inc_frame % INC_REFRESH;
+	for (int i = 0; i < points_len; i++) {
+		inc_hist_x[inc_now * points_len + i] = points[i].px;
+		inc_hist_y[inc_now * points_len + i] = points[i].py;
+	}
+
+	IncGrid(points, points_len);
+
+	inc_frame++;
+	inc_pixels_total += len;
+	inc_blocks_total += inc_blocks_w * inc_blocks_h;
+
+	return 2;
+}
+
+static int IntCompare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+// IncBlockCandidates: finds the points that could be closest to a pixel of block b, at
+// [x0, x1) x [y0, y1), and how far they've moved
+static void IncBlockCandidates(IncBlock *b, int x0, int y0, int x1, int y1)
+{
+	double lox = x0, hix = x1 - 1, loy = y0, hiy = y1 - 1;
+	double cx = (lox + hix) / 2, cy = (loy + hiy) / 2;
+	int gx = IncGridCoord(cx, inc_grid_w), gy = IncGridCoord(cy, inc_grid_h);
+	double best = DBL_MAX;
+
+	// the point with the smallest farthest distance, searched in rings like the grid engine, and a
+	// point's farthest distance is never less than its distance to the middle of the block
+	for (int r = 0;; r++) {
+		int glox = gx - r, ghix = gx + r, gloy = gy - r, ghiy = gy + r;
+
+		for (int j = gloy; j <= ghiy; j++) {
+			if (j < 0 || j >= inc_grid_h)
+				continue;
+			for (int i = glox; i <= ghix; i++) {
+				if (i < 0 || i >= inc_grid_w || (j != gloy && j != ghiy && i != glox && i != ghix))
+					continue;
+
+				int c = i + inc_grid_w * j;
+				for (int k = inc_grid_start[c]; k < inc_grid_start[c + 1]; k++) {
+					Point *p = inc_points + inc_grid_points[k];
+					double xd = fmax(fabs(p->px - lox), fabs(p->px - hix));
+					double yd = fmax(fabs(p->py - loy), fabs(p->py - hiy));
+					best = fmin(best, xd * xd + yd * yd);
+				}
+			}
+		}
+
+		if (glox <= 0 && gloy <= 0 && ghix >= inc_grid_w - 1 && ghiy >= inc_grid_h - 1)
+			break;
+
+		double edge = DBL_MAX;
+		if (glox > 0)
+			edge = fmin(edge, cx - (double)glox * inc_grid_size);
+		if (ghix < inc_grid_w - 1)
+			edge = fmin(edge, (double)(ghix + 1) * inc_grid_size - cx);
+		if (gloy > 0)
+			edge = fmin(edge, cy - (double)gloy * inc_grid_size);
+		if (ghiy < inc_grid_h - 1)
+			edge = fmin(edge, (double)(ghiy + 1) * inc_grid_size - cy);
+
+		if (best != DBL_MAX && edge * edge > best * INC_GRID_SLOP)
+			break;
+	}
+
+	// NOTE (Brian) taking the points up to another grid cell further out than strictly needed leaves
+	// pixels some room before the cutoff has to stand in for everything past it
+	double cutoff = sqrt(best * INC_GRID_SLOP) + inc_grid_size;
+	b->cutoff = (float)cutoff;
+	b->candidates_len = 0;
+
+	int cx0 = IncGridCoord(lox - cutoff, inc_grid_w), cx1 = IncGridCoord(hix + cutoff, inc_grid_w);
+	int cy0 = IncGridCoord(loy - cutoff, inc_grid_h), cy1 = IncGridCoord(hiy + cutoff, inc_grid_h);
+
+	for (int j = cy0; j <= cy1; j++) {
+		for (int i = cx0; i <= cx1; i++) {
+			int c = i + inc_grid_w * j;
+			for (int k = inc_grid_start[c]; k < inc_grid_start[c + 1]; k++) {
+				int idx = inc_grid_points[k];
+				Point *p = inc_points + idx;
+				double xd = p->px < lox ? lox - p->px : p->px > hix ? p->px - hix : 0;
+				double yd = p->py < loy ? loy - p->py : p->py > hiy ? p->py - hiy : 0;
+				if (xd * xd + yd * yd > cutoff * cutoff)
+					continue;
+
+				if (b->candidates_len == b->candidates_cap) {
+					b->candidates_cap = b->candidates_cap ? b->candidates_cap * 2 : 16;
+					b->candidates = realloc(b->candidates, b->candidates_cap * sizeof(*b->candidates));
+					assert(b->candidates != NULL);
+				}
+				b->candidates[b->candidates_len++] = idx;
+			}
+		}
+	}
+
+	qsort(b->candidates, b->candidates_len, sizeof(*b->candidates), IntCompare);
+
+	memset(b->moved, 0, sizeof(b->moved));
+	if (inc_full)
+		return;
+
+	for (int k = 0; k < b->candidates_len; k++) {
+		int i = b->candidates[k];
+		for (int f = 0; f < INC_REFRESH; f++) {
+			float xd = inc_points[i].px - inc_hist_x[f * inc_points_len + i];
+			float yd = inc_points[i].py - inc_hist_y[f * inc_points_len + i];
+			b->moved[f] = fmaxf(b->moved[f], sqrtf(xd * xd + yd * yd));
+		}
+	}
+}
+
+// IncPick: UpdatePixelForPoints over the block's candidates, keeping the runners up and the next
+// closest too, returns true if the pixel has a different owner than it had
+static bool IncPick(IncBlock *block, int x, int y)
+{
+	float x1 = x, y1 = y;
+	float dist[INC_RIVALS + 2];
+	int idx[INC_RIVALS + 1];
+
+	for (int k = 0; k < INC_RIVALS + 2; k++)
+		dist[k] = FLT_MAX;
+	for (int k = 0; k < INC_RIVALS + 1; k++)
+		idx[k] = -1;
+
+	for (int k = 0; k < block->candidates_len; k++) {
+		int i = block->candidates[k];
+		float xd = inc_points[i].px - x1;
+		float yd = inc_points[i].py - y1;
+		float currdist = xd * xd + yd * yd;
+
+		// strictly closer moves up, so equal distances stay behind the lower index
+		int at = INC_RIVALS + 2;
+		while (at > 0 && currdist < dist[at - 1])
+			at--;
+		if (at == INC_RIVALS + 2)
+			continue;
+
+		for (int j = INC_RIVALS + 1; j > at; j--) {
+			dist[j] = dist[j - 1];
+			if (j < INC_RIVALS + 1)
+				idx[j] = idx[j - 1];
+		}
+		dist[at] = currdist;
+		if (at < INC_RIVALS + 1)
+			idx[at] = i;
+	}
+
+	assert(idx[0] >= 0);
+
+	size_t i = x + (size_t)G_WIDTH * y;
+	bool changed = inc_labels[i] != (Label)idx[0];
+	inc_labels[i] = (Label)idx[0];
+	for (int k = 0; k < INC_RIVALS; k++)
+		inc_rivals[INC_RIVALS * i + k] = (Label)(idx[k + 1] >= 0 ? idx[k + 1] : idx[0]);
+	inc_next[i] = fminf(sqrtf(dist[INC_RIVALS + 1]), block->cutoff);
+	inc_picked_in[i] = (unsigned char)inc_now;
+	return changed;
+}
+
+// IncLoses: true if other is now closer to the pixel than owner at dist, the way UpdatePixelForPoints
+// breaks ties
+static bool IncLoses(int owner, float dist, int other, float x1, float y1)
+{
+	float xd = inc_points[other].px - x1;
+	float yd = inc_points[other].py - y1;
+	float other_dist = xd * xd + yd * yd;
+	return other_dist < dist || (other_dist == dist && other < owner);
+}
+
+// IncKeep: true if the owner of the pixel is still the one UpdatePixelForPoints would pick
+static bool IncKeep(IncBlock *block, int x, int y)
+{
+	size_t i = x + (size_t)G_WIDTH * y;
+	float x1 = x, y1 = y;
+
+	int owner = inc_labels[i];
+	float xd = inc_points[owner].px - x1;
+	float yd = inc_points[owner].py - y1;
+	float dist = xd * xd + yd * yd;
+
+	// where the points were that long ago is about to be written over
+	int age = (inc_now - inc_picked_in[i] + INC_REFRESH) % INC_REFRESH;
+	if (age == INC_REFRESH - 1)
+		return false;
+
+	for (int k = 0; k < INC_RIVALS; k++) {
+		if (IncLoses(owner, dist, inc_rivals[INC_RIVALS * i + k], x1, y1))
+			return false;
+	}
+
+	return sqrtf(dist) + block->moved[inc_picked_in[i]] + INC_SLOP < inc_next[i];
+}
+
+// IncPhase: phase 0 gets every block ready, each one by the rectangle with its top left pixel, and
+// phase 1 picks whatever pixels have to be picked again
+static void IncPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	if (phase == 0) {
+		long long candidates = 0;
+
+		for (int by = (y0 + INC_BLOCK - 1) / INC_BLOCK; by * INC_BLOCK < y1; by++) {
+			for (int bx = (x0 + INC_BLOCK - 1) / INC_BLOCK; bx * INC_BLOCK < x1; bx++) {
+				int bi = by * inc_blocks_w + bx;
+				int bx0 = bx * INC_BLOCK, by0 = by * INC_BLOCK;
+				int bx1 = bx0 + INC_BLOCK < G_WIDTH ? bx0 + INC_BLOCK : G_WIDTH;
+				int by1 = by0 + INC_BLOCK < G_HEIGHT ? by0 + INC_BLOCK : G_HEIGHT;
+
+				IncBlockCandidates(inc_blocks + bi, bx0, by0, bx1, by1);
+				candidates += inc_blocks[bi].candidates_len;
+			}
+		}
+
+		atomic_fetch_add(&inc_candidates, candidates);
+		return;
+	}
+
+	long long picked = 0, changed = 0;
+
+	for (int y = y0; y < y1; y++) {
+		IncBlock *blocks = inc_blocks + (y / INC_BLOCK) * inc_blocks_w;
+		for (int x = x0; x < x1; x++) {
+			IncBlock *b = blocks + x / INC_BLOCK;
+			if (inc_full || !IncKeep(b, x, y)) {
+				changed += IncPick(b, x, y);
+				picked++;
+			}
+		}
+	}
+
+	atomic_fetch_add(&inc_picked, picked);
+	atomic_fetch_add(&inc_changed, changed);
+}
+
+static void IncReport()
+{
+	long long picked = atomic_exchange(&inc_picked, 0);
+	long long changed = atomic_exchange(&inc_changed, 0);
+	long long candidates = atomic_exchange(&inc_candidates, 0);
+
+	printf("  Picked Pixels %lld of %lld (%.2f%%), none kept more than %d frames\n",
+		picked, inc_pixels_total, 100.0 * picked / inc_pixels_total, INC_REFRESH - 1);
+	printf("  Owner Changed %lld (%.2f%%), the least that could have been picked\n", changed, 100.0 * changed / inc_pixels_total);
+	printf("  Candidates    avg %.2f per %dx%d block\n", (double)candidates / inc_blocks_total, INC_BLOCK, INC_BLOCK);
+
+	inc_pixels_total = 0;
+	inc_blocks_total = 0;
+}
+
+Engine IncrementalEngine = { "incremental", IncBegin, IncPhase, IncReport };
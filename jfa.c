@@ -0,0 +1,162 @@
+// Brian Chrzanowski
+// Jump Flooding Voronoi Engine
+//
+// Every pixel holds the index of the best point it knows about. Starting with a step of half the
+// frame size, each pass lets a pixel look at the 8 pixels 'step' away and steal their point if it's
+// closer, then the step is halved. After log2(max(W, H)) passes nearly every pixel holds its true
+// closest point, and the cost doesn't depend on how many points there are.
+//
+// JFA is approximate, a small number of pixels near cell edges can end up with the wrong point. The
+// 1+JFA variant runs one extra pass with a step of 1 before the regular passes, which fixes most of
+// those pixels for the cost of one more pass.
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+static Label *jfa_labels;
+static Point *jfa_points;
+static int jfa_points_len;
+
+static int32_t *jfa_buffers[2];
+static size_t jfa_buffer_len;
+
+static int jfa_steps[32];
+static int jfa_steps_len;
+
+static float JFADist(Point *point, int x, int y)
+{
+	float xd = point->px - (float)x;
+	float yd = point->py - (float)y;
+	return xd * xd + yd * yd;
+}
+
+// JFAClamp: points are allowed to wander a little outside of the frame, so plant them on the edge
+static int JFAClamp(float v, int hi)
+{
+	int i = (int)v;
+	if (i < 0)
+		return 0;
+	if (i >= hi)
+		return hi - 1;
+	return i;
+}
+
+static int JFABegin(Label *labels, Point *points, int points_len, bool extra)
+{
+	size_t len = (size_t)G_WIDTH * G_HEIGHT;
+
+	jfa_labels = labels;
+	jfa_points = points;
+	jfa_points_len = points_len;
+
+	if (jfa_buffer_len != len) {
+		free(jfa_buffers[0]);
+		free(jfa_buffers[1]);
+		jfa_buffers[0] = malloc(len * sizeof(*jfa_buffers[0]));
+		jfa_buffers[1] = malloc(len * sizeof(*jfa_buffers[1]));
+		assert(jfa_buffers[0] != NULL && jfa_buffers[1] != NULL);
+		jfa_buffer_len = len;
+	}
+
+	// NOTE (Brian) all bits set is -1, which is what marks a pixel without a point
+	memset(jfa_buffers[0], 0xff, len * sizeof(*jfa_buffers[0]));
+
+	for (int i = 0; i < points_len; i++) {
+		int x = JFAClamp(points[i].px, G_WIDTH);
+		int y = JFAClamp(points[i].py, G_HEIGHT);
+		int32_t *slot = jfa_buffers[0] + (x + G_WIDTH * y);
+
+		// two points in the same pixel, the closer one wins, ties go to the lower index
+		if (*slot < 0 || JFADist(points + i, x, y) < JFADist(points + *slot, x, y))
+			*slot = i;
+	}
+
+	jfa_steps_len = 0;
+
+	if (extra)
+		jfa_steps[jfa_steps_len++] = 1;
+
+	int size = 1;
+	while (size < G_WIDTH || size < G_HEIGHT)
+		size <<= 1;
+
+	for (int step = size / 2; step >= 1; step /= 2)
+		jfa_steps[jfa_steps_len++] = step;
+
+	// one phase per pass, then one more to copy point indices into the labels
+	return jfa_steps_len + 1;
+}
+
+static void JFAPass(int32_t *dst, int32_t *src, int step, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			int32_t best = src[x + G_WIDTH * y];
+			float bestdist = best < 0 ? FLT_MAX : JFADist(jfa_points + best, x, y);
+
+			for (int j = -step; j <= step; j += step) {
+				int ny = y + j;
+				if (ny < 0 || ny >= G_HEIGHT)
+					continue;
+
+				for (int i = -step; i <= step; i += step) {
+					int nx = x + i;
+					if (nx < 0 || nx >= G_WIDTH)
+						continue;
+
+					int32_t candidate = src[nx + G_WIDTH * ny];
+					if (candidate < 0 || candidate == best)
+						continue;
+
+					float d = JFADist(jfa_points + candidate, x, y);
+					if (d < bestdist || (d == bestdist && candidate < best)) {
+						best = candidate;
+						bestdist = d;
+					}
+				}
+			}
+
+			dst[x + G_WIDTH * y] = best;
+		}
+	}
+}
+
+static void JFAResolve(int32_t *src, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			int32_t idx = src[x + G_WIDTH * y];
+			assert(idx >= 0 && idx < jfa_points_len);
+			jfa_labels[x + G_WIDTH * y] = (Label)idx;
+		}
+	}
+}
+
+static void JFAPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	int32_t *src = jfa_buffers[phase & 1];
+	int32_t *dst = jfa_buffers[(phase + 1) & 1];
+
+	if (phase < jfa_steps_len) {
+		JFAPass(dst, src, jfa_steps[phase], x0, y0, x1, y1);
+	} else {
+		JFAResolve(src, x0, y0, x1, y1);
+	}
+}
+
+static int JFABeginPlain(Label *labels, Point *points, int points_len)
+{
+	return JFABegin(labels, points, points_len, false);
+}
+
+static int JFABeginExtra(Label *labels, Point *points, int points_len)
+{
+	return JFABegin(labels, points, points_len, true);
+}
+
+Engine JFAEngine = { "jfa", JFABeginPlain, JFAPhase };
+Engine JFA1Engine = { "jfa1", JFABeginExtra, JFAPhase };
@@ -0,0 +1,173 @@
+// Brian Chrzanowski
+// Lloyd Relaxation
+//
+// Instead of bouncing around, every point moves to the centroid of its own cell, which after enough
+// frames settles into a centroidal Voronoi diagram with cells that are all about the same size.
+//
+// The centroids come out of the resolve phase, which is already reading every label: each worker
+// adds the area and the x and y sums of the runs of labels in its tiles to its own array of moments,
+// so the frame isn't gone over a second time. Afterwards the arrays are added together in a tree,
+// half of the workers adding in their neighbour's array every round with a PoolBarrier in between,
+// and then every worker moves its share of the points and clears their moments for the next frame.
+//
+// NOTE (Brian) the moments are integers, so the centroids don't depend on how the tiles were split
+// up or who added what first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+bool G_Lloyd;
+
+typedef struct {
+	int64_t area;
+	int64_t x;
+	int64_t y;
+} LloydMoment;
+
+typedef struct {
+	_Alignas(64) double moved; // sum of how far this worker's points moved
+	double moved_max;
+	double reduce_time;
+} LloydWorker;
+
+static LloydMoment *lloyd_moments; // lloyd_stride moments per worker, each one cache line aligned
+static LloydWorker *lloyd_workers;
+static void *lloyd_alloc;
+static int lloyd_workers_len;
+static int lloyd_points_len;
+static int lloyd_stride;
+
+// LloydInit: moments for workers workers and points_len points, all zero
+void LloydInit(int workers, int points_len)
+{
+	LloydFree();
+
+	// NOTE (Brian) 8 moments is three cache lines, so every worker's array starts on its own
+	lloyd_stride = (points_len + 7) & ~7;
+	lloyd_workers_len = workers;
+	lloyd_points_len = points_len;
+
+	size_t moments = (size_t)workers * lloyd_stride * sizeof(*lloyd_moments);
+	lloyd_alloc = calloc(1, moments + (workers + 1) * sizeof(*lloyd_workers) + 64);
+	assert(lloyd_alloc != NULL);
+
+	lloyd_moments = (LloydMoment *)(((uintptr_t)lloyd_alloc + 63) & ~(uintptr_t)63);
+	lloyd_workers = (LloydWorker *)((char *)lloyd_moments + moments);
+}
+
+void LloydFree()
+{
+	free(lloyd_alloc);
+	lloyd_alloc = NULL;
+	lloyd_moments = NULL;
+	lloyd_workers = NULL;
+	lloyd_workers_len = 0;
+}
+
+// LloydAccumulate: adds the cells' area and first moments over [x0, x1) x [y0, y1) to worker's array
+void LloydAccumulate(int worker, Label *labels, int x0, int y0, int x1, int y1)
+{
+	LloydMoment *moments = lloyd_moments + (size_t)worker * lloyd_stride;
+
+	for (int y = y0; y < y1; y++) {
+		Label *row = labels + (size_t)G_WIDTH * y;
+		int x = x0;
+
+		// a run of n pixels from start has x sum n * (start + end) / 2, which is always a whole number
+		while (x < x1) {
+			Label label = row[x];
+			int start = x;
+			while (x < x1 && row[x] == label)
+				x++;
+
+			int64_t n = x - start;
+			moments[label].area += n;
+			moments[label].x += n * (start + x - 1) / 2;
+			moments[label].y += n * y;
+		}
+	}
+}
+
+// LloydStep: called by every worker of a pool job, adds up the moments and moves each point to the
+// centroid of its cell
+void LloydStep(Point *points, int worker, int workers)
+{
+	assert(workers == lloyd_workers_len);
+
+	LloydWorker *self = lloyd_workers + worker;
+	double start = GetTime();
+
+	for (int step = 1; step < workers; step *= 2) {
+		if (worker % (2 * step) == 0 && worker + step < workers) {
+			LloydMoment *into = lloyd_moments + (size_t)worker * lloyd_stride;
+			LloydMoment *from = lloyd_moments + (size_t)(worker + step) * lloyd_stride;
+
+			for (int i = 0; i < lloyd_points_len; i++) {
+				into[i].area += from[i].area;
+				into[i].x += from[i].x;
+				into[i].y += from[i].y;
+			}
+
+			memset(from, 0, lloyd_points_len * sizeof(*from));
+		}
+
+		PoolBarrier(worker);
+	}
+
+	self->reduce_time += GetTime() - start;
+
+	int lo = (int)((int64_t)lloyd_points_len * worker / workers);
+	int hi = (int)((int64_t)lloyd_points_len * (worker + 1) / workers);
+
+	double moved = 0, moved_max = 0;
+
+	for (int i = lo; i < hi; i++) {
+		LloydMoment *m = lloyd_moments + i;
+
+		// a point whose cell fell between the pixels stays where it is
+		if (m->area > 0) {
+			float cx = (float)((double)m->x / m->area);
+			float cy = (float)((double)m->y / m->area);
+			float d = hypotf(cx - points[i].px, cy - points[i].py);
+
+			points[i].px = cx;
+			points[i].py = cy;
+
+			moved += d;
+			if (moved_max < d)
+				moved_max = d;
+		}
+
+		m->area = m->x = m->y = 0;
+	}
+
+	self->moved = moved;
+	self->moved_max = moved_max;
+}
+
+// LloydMoved: the mean and the largest distance a point moved on the last step, which goes to 0 as
+// the diagram converges
+void LloydMoved(double *mean, double *max)
+{
+	double sum = 0;
+
+	*max = 0;
+	for (int i = 0; i < lloyd_workers_len; i++) {
+		sum += lloyd_workers[i].moved;
+		if (*max < lloyd_workers[i].moved_max)
+			*max = lloyd_workers[i].moved_max;
+	}
+
+	*mean = lloyd_points_len > 0 ? sum / lloyd_points_len : 0;
+}
+
+// LloydReduceTime: how long worker 0 spent in the tree reduction, in total
+double LloydReduceTime()
+{
+	return lloyd_workers_len > 0 ? lloyd_workers[0].reduce_time : 0;
+}
@@ -13,16 +13,21 @@
 #include <limits.h>
 #include <float.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <Shobjidl.h>
 
 #include "cppjunk.h"
+#endif
+
 #include "pcg_basic.h"
+#include "voronoi.h"
 
 #define ARRSIZE(ARRAY_) (sizeof(ARRAY_)/sizeof((ARRAY_)[0]))
 
@@ -33,40 +38,46 @@ int G_WIDTH;
 int G_HEIGHT;
 int G_POINTS;
 int G_THREADS;
+int G_INFLIGHT = 3;
+uint64_t G_Seed; // 0 for a different one every run
 
+// FrameJob: everything the workers need for one frame, the phase after the engine's last one
+// resolves the colors
 typedef struct {
-	float px, py;
-	float vx, vy;
-	float ax, ay;
-	uint32_t color;
-} Point;
-
-typedef struct {
-	uint8_t r, g, b, a;
-} Color;
-
-typedef union {
-	struct {
-		uint8_t r, g, b, a;
-	};
-	uint32_t color;
-} Pixel;
-
-typedef struct {
-	int row;
-	int rows;
+	int phases;
 	Pixel *pixels;
+	Label *labels;
+	uint32_t *palette;
 	Point *points;
-	int *run;
-	int *timestep;
-	int *finished;
-} ThreadData;
+} FrameJob;
 
 Color G_SkewColor = { 0xff, 0x00, 0x00, 0xff };
 
+Engine *G_Engine = &BruteEngine;
+
+char *G_SVG = NULL;
+
+Engine *G_Engines[] = {
+	&BruteEngine,
+	&JFAEngine,
+	&JFA1Engine,
+	&ScanlineEngine,
+	&SIMDEngine,
+	&GridEngine,
+	&KDTreeEngine,
+	&FortuneEngine,
+	&IncrementalEngine,
+	&TileEngine,
+	&QuadtreeEngine,
+	&MetricEngine,
+};
+
 void SeedRNG()
 {
-	pcg32_srandom(time(NULL), (intptr_t)&SeedRNG);
+	if (G_Seed != 0)
+		pcg32_srandom(G_Seed, 0);
+	else
+		pcg32_srandom(time(NULL), (intptr_t)&SeedRNG);
 }
 
 uint32_t RandInt()
@@ -112,62 +123,77 @@ uint32_t GetRandomColor(Color *in)
 }
 
 // GenerateRandomPoint: randomizes x and y, with a random color
+//
+// NOTE (Brian) positions and velocities are snapped to the grid PointAt needs to jump ahead exactly
 void GenerateRandomPoint(Point *p)
 {
-	p->px = RandomFloat(G_WIDTH);
-	p->py = RandomFloat(G_HEIGHT);
-	p->vx = RandomFloat(5) - 10.0f;
-	p->vy = RandomFloat(5) - 10.0f;
+	p->px = TrajSnap(RandomFloat(G_WIDTH));
+	p->py = TrajSnap(RandomFloat(G_HEIGHT));
+	p->vx = TrajSnap(RandomFloat(5) - 10.0f);
+	p->vy = TrajSnap(RandomFloat(5) - 10.0f);
 	// p->ax = RandomFloat(1) - 2.0f;
 	// p->ay = RandomFloat(1) - 2.0f;
 	p->color = GetRandomColor(&G_SkewColor);
 }
 
-float dist(float x1, float y1, float x2, float y2)
+// GenerateRandomWeight: weights up to about half the spacing between points, so they bend the cells
+// without eating them
+//
+// NOTE (Brian) this is its own draw after all of the points, so a -seed run that never reads the
+// weights gets exactly the points it got before there were any
+void GenerateRandomWeight(Point *p)
 {
-	return sqrt(pow(x1 - x2, 2) + pow(y1 - y2, 2));
+	p->w = RandomFloat(sqrtf((float)G_WIDTH * G_HEIGHT / G_POINTS) / 2);
 }
 
-// UpdatePixelForPoints
-void UpdatePixelForPoints(Pixel *pixel, int x, int y, Point *points, size_t points_len)
+// UpdatePixelForPoints: the plain Euclidean nearest point, everything else gets checked against this
+void UpdatePixelForPoints(Label *label, int x, int y, Point *points, size_t points_len)
 {
-	float x1, y1, x2, y2, xd, yd;
-	float min = FLT_MAX;
-	float currdist = 0;
-	Point *picked = NULL;
+	int picked;
 
-	x1 = x;
-	y1 = y;
+	NEAREST_POINT(METRIC_EUCLID, picked, x, y, points, points_len);
 
-	for (int i = 0; i < points_len; i++) {
-#if 0
-		// currdist = dist(x, y, points[i].px, points[i].py);
-#else
-		x2 = points[i].px;
-		y2 = points[i].py;
-		xd = x2 - x1;
-		yd = y2 - y1;
-		currdist = xd * xd + yd * yd;
-#endif
-		if (currdist < min) {
-			min = currdist;
-			picked = points + i;
-		}
-	}
+	assert(picked >= 0);
+
+	*label = (Label)picked;
+}
 
-	assert(picked != NULL);
+static Label *brute_labels;
+static Point *brute_points;
+static int brute_points_len;
 
-	pixel->color = picked->color;
+static int BruteBegin(Label *labels, Point *points, int points_len)
+{
+	brute_labels = labels;
+	brute_points = points;
+	brute_points_len = points_len;
+	return 1;
+}
+
+static void BrutePhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			UpdatePixelForPoints(brute_labels + (x + G_WIDTH * y), x, y, brute_points, brute_points_len);
+		}
+	}
 }
 
-// DrawPoint: draws a colored dot at the point (x, y)
-void DrawPoint(Pixel *pixels, int x, int y)
+Engine BruteEngine = { "brute", BruteBegin, BrutePhase };
+
+// DrawPoint: draws a colored dot at the point (x, y), only the part of it in rows [y0, y1)
+void DrawPoint(Pixel *pixels, int x, int y, int y0, int y1)
 {
+	if (y0 < 0)
+		y0 = 0;
+	if (y1 > G_HEIGHT)
+		y1 = G_HEIGHT;
+
 	for (int i = -2; i <= 2; i++) {
 		for (int j = -2; j <= 2; j++) {
-			if (x + i < 0 || x + i > G_WIDTH)
+			if (x + i < 0 || x + i >= G_WIDTH)
 				continue;
-			if (y + j < 0 || y + j > G_WIDTH)
+			if (y + j < y0 || y + j >= y1)
 				continue;
 			pixels[(x + i) + G_WIDTH * (y + j)].g = 0xff;
 		}
@@ -196,33 +222,24 @@ void MovePoint(Point *point)
 #undef OOB
 }
 
-DWORD MultiPaintThreadProc(LPVOID param)
+// MultiPaintTile: one tile of a phase
+void MultiPaintTile(void *arg, int worker, int phase, int x0, int y0, int x1, int y1)
 {
-	ThreadData *data = param;
-
-	Pixel *pixels = data->pixels;
-	Point *points = data->points;
-
-	int timestep = 0;
-
-	for (;;) {
-		BOOL wait = WaitOnAddress(data->timestep, &timestep, sizeof(*data->timestep), INFINITE);
-		if (wait == FALSE) {
-			if (data->run)
-				continue;
-			break;
-		}
-
-		for (int y = data->row; y < data->row + data->rows; y++) {
-			for (int x = 0; x < G_WIDTH; x++) {
-				UpdatePixelForPoints(pixels + (x + G_WIDTH * y), x, y, points, G_POINTS);
-			}
-		}
-
-		InterlockedIncrement((LONG*)data->finished);
+	FrameJob *job = arg;
+
+	// NOTE (Brian) the labels of this tile are still in cache from resolving it
+	if (phase == job->phases && G_Lloyd)
+		LloydAccumulate(worker, job->labels, x0, y0, x1, y1);
+
+	if (phase == job->phases && G_Blur > 1) {
+		ResolveBlur(job->pixels, job->palette, x0, y0, x1, y1);
+	} else if (phase == job->phases && G_AA) {
+		ResolveAA(job->pixels, job->labels, job->palette, job->points, x0, y0, x1, y1);
+	} else if (phase == job->phases) {
+		ResolvePalette(job->pixels, job->labels, job->palette, x0, y0, x1, y1);
+	} else {
+		G_Engine->Phase(worker, phase, x0, y0, x1, y1);
 	}
-
-	return 0;
 }
 
 void PrintPoint(Point *point, int idx)
@@ -238,6 +255,7 @@ void PrintPoint(Point *point, int idx)
 
 int UpdateWallpaper(char *file)
 {
+#ifdef _WIN32
 	int rc;
 	char fname[1024] = { 0 };
 
@@ -248,26 +266,58 @@ int UpdateWallpaper(char *file)
 
 	rc = SystemParametersInfo(SPI_SETDESKWALLPAPER, 0, fname, SPIF_UPDATEINIFILE|SPIF_SENDWININICHANGE);
 	return rc ? 0 : -1;
+#else
+	// NOTE (Brian) there's no one way to set the wallpaper everywhere else, the frame is just left in file
+	return 0;
+#endif
+}
+
+// RenderFrame: runs every phase of the engine over the whole frame on the calling thread
+void RenderFrame(Engine *engine, Label *labels, Point *points)
+{
+	int phases = engine->Begin(labels, points, G_POINTS);
+	for (int p = 0; p < phases; p++) {
+		engine->Phase(0, p, 0, 0, G_WIDTH, G_HEIGHT);
+	}
+}
+
+// GetTime: returns a monotonic time in seconds
+double GetTime()
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, freq;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&freq);
+	return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
 }
 
-void SingleThreaded(Pixel *pixels, Point *points)
+void SingleThreaded(Pixel *pixels, Label *labels, Point *points)
 {
 	int rc;
 
+	uint32_t *palette = calloc(G_POINTS, sizeof(*palette));
+
 	char image_name[256] = { 0 };
 	snprintf(image_name, sizeof image_name, "%s.bmp", TEMPLATE_NAME);
 
 	for (int t = 0; t < G_TIMESTEPS; t++) {
 		printf("\rTimestep %d", t);
 
-		for (int x = 0; x < G_WIDTH; x++) {
-			for (int y = 0; y < G_HEIGHT; y++) {
-				UpdatePixelForPoints(pixels + (x + G_WIDTH * y), x, y, points, G_POINTS);
-			}
-		}
+		RenderFrame(G_Engine, labels, points);
+
+		BuildPalette(palette, points, G_POINTS, 0);
+		if (G_AA)
+			ResolveAA(pixels, labels, palette, points, 0, 0, G_WIDTH, G_HEIGHT);
+		else
+			ResolvePalette(pixels, labels, palette, 0, 0, G_WIDTH, G_HEIGHT);
 
 		for (int i = 0; i < G_POINTS; i++) {
-			DrawPoint(pixels, points[i].px, points[i].py);
+			DrawPoint(pixels, points[i].px, points[i].py, 0, G_HEIGHT);
 		}
 
 		rc = stbi_write_bmp(image_name, G_WIDTH, G_HEIGHT, 4, (void *)pixels);
@@ -276,6 +326,11 @@ void SingleThreaded(Pixel *pixels, Point *points)
 			exit(1);
 		}
 
+		if (G_SVG != NULL && WriteSVG(G_SVG, points, G_POINTS) < 0) {
+			fprintf(stderr, "Could not write %s\n", G_SVG);
+			exit(1);
+		}
+
 		rc = UpdateWallpaper(image_name);
 		if (rc < 0) {
 			fprintf(stderr, "Could not set wallpaper...\n");
@@ -286,110 +341,815 @@ void SingleThreaded(Pixel *pixels, Point *points)
 			MovePoint(points + i);
 		}
 	}
+
+	free(palette);
+}
+
+// StepJob: the dots for the frame that was just drawn, and the points to move on to the next one
+typedef struct {
+	Pixel *pixels;
+	Point *drawn; // the frame's own copy, nothing moves these
+	Point *points;
+	PointSet *set; // the same points, which is what actually gets stepped
+} StepJob;
+
+// StepPoints: stamps the dots inside this worker's band of rows, then moves this worker's share of
+// the points, bouncing them off each other first with G_Collide and pulling them towards each other
+// with G_Force, or relaxes them all together with G_Lloyd. Bands and shares don't overlap and the dots
+// come from the frame's copy, so there's nothing to lock.
+void StepPoints(void *arg, int worker, int workers)
+{
+	StepJob *job = arg;
+
+	int y0 = (int)((int64_t)G_HEIGHT * worker / workers);
+	int y1 = (int)((int64_t)G_HEIGHT * (worker + 1) / workers);
+
+	for (int i = 0; i < G_POINTS; i++) {
+		int y = job->drawn[i].py;
+		if (y + 2 >= y0 && y - 2 < y1)
+			DrawPoint(job->pixels, job->drawn[i].px, job->drawn[i].py, y0, y1);
+	}
+
+	int lo = (int)((int64_t)G_POINTS * worker / workers);
+	int hi = (int)((int64_t)G_POINTS * (worker + 1) / workers);
+
+	if (G_Lloyd) {
+		LloydStep(job->points, worker, workers);
+		PointSetLoad(job->set, job->points, lo, hi);
+		return;
+	}
+
+	if (G_Collide)
+		CollideStep(job->set, worker, workers);
+	if (G_Force != 0)
+		ForceStep(job->set, worker, workers);
+
+	PointSetStep(job->set, lo, hi);
+	PointSetStore(job->set, job->points, lo, hi);
+}
+
+// Frame: one frame in flight through the pipeline, with its own copy of the points it was drawn from
+typedef struct {
+	int timestep;
+	Pixel *pixels;
+	Point *points;
+	unsigned char *bmp;
+	size_t bmp_len;
+	size_t bmp_cap;
+} Frame;
+
+// Pipeline: the queues between the stages, frames go free -> drawn -> encoded -> free again
+typedef struct {
+	Queue free;
+	Queue drawn;
+	Queue encoded;
+	char *image_name;
+	atomic_bool failed;
+	double encode_time;
+	double sink_time;
+} Pipeline;
+
+static void FrameWrite(void *context, void *data, int size)
+{
+	Frame *frame = context;
+
+	if (frame->bmp_cap < frame->bmp_len + size) {
+		frame->bmp_cap = (frame->bmp_len + size) * 2;
+		frame->bmp = realloc(frame->bmp, frame->bmp_cap);
+		assert(frame->bmp != NULL);
+	}
+
+	memcpy(frame->bmp + frame->bmp_len, data, size);
+	frame->bmp_len += size;
+}
+
+// EncodeFrame: turns the frame into a bmp in memory
+static void EncodeFrame(Frame *frame)
+{
+	frame->bmp_len = 0;
+	if (stbi_write_bmp_to_func(FrameWrite, frame, G_WIDTH, G_HEIGHT, 4, (void *)frame->pixels) == 0) {
+		fprintf(stderr, "There was an error writing the file!");
+		exit(1);
+	}
+}
+
+// EncodeStage: encodes every frame that's been drawn
+void EncodeStage(void *arg)
+{
+	Pipeline *pipe = arg;
+	Frame *frame;
+
+	while ((frame = QueuePop(&pipe->drawn)) != NULL) {
+		double start = GetTime();
+		EncodeFrame(frame);
+		pipe->encode_time += GetTime() - start;
+
+		QueuePush(&pipe->encoded, frame);
+	}
+
+	QueuePush(&pipe->encoded, NULL);
 }
 
-void MultiThreaded(Pixel *pixels, Point *points)
+// SinkFrame: writes one encoded frame out and sets the wallpaper
+static void SinkFrame(Pipeline *pipe, Frame *frame)
 {
-	int run, timestep, finished, rc;
+	double start = GetTime();
+
+	FILE *fp = fopen(pipe->image_name, "wb");
+	if (fp == NULL || fwrite(frame->bmp, 1, frame->bmp_len, fp) != frame->bmp_len) {
+		fprintf(stderr, "There was an error writing the file!");
+		exit(1);
+	}
+	fclose(fp);
+
+	if (G_SVG != NULL && WriteSVG(G_SVG, frame->points, G_POINTS) < 0) {
+		fprintf(stderr, "Could not write %s\n", G_SVG);
+		exit(1);
+	}
+
+	if (!atomic_load(&pipe->failed) && UpdateWallpaper(pipe->image_name) < 0) {
+		fprintf(stderr, "Could not set wallpaper...\n");
+		atomic_store(&pipe->failed, true);
+	}
 
-	G_THREADS = 20;
+	pipe->sink_time += GetTime() - start;
+}
 
+// SinkStage: writes the files out and sets the wallpaper
+void SinkStage(void *arg)
+{
+	Pipeline *pipe = arg;
+	Frame *frame;
+
+	while ((frame = QueuePop(&pipe->encoded)) != NULL) {
+		SinkFrame(pipe, frame);
+		QueuePush(&pipe->free, frame);
+	}
+}
+
+// MultiThreaded: the main thread rasterizes and moves the points on the pool, while up to
+// G_INFLIGHT earlier frames are being encoded and written out behind it
+void MultiThreaded(Pixel *pixels, Label *labels, Point *points)
+{
 	char image_name[256] = { 0 };
 	snprintf(image_name, sizeof image_name, "%s.bmp", TEMPLATE_NAME);
 
-	HANDLE *threads = calloc(G_THREADS, sizeof(*threads));
-	ThreadData *thread_data = calloc(G_THREADS, sizeof(*thread_data));
-
-	{
-		// NOTE (Brian) the threading model for this threading based attempt at speed is to delegate
-		// a number of rows for the particular thread to complete. Because of this decision, it is
-		// very important to choose a number that will EVENLY divide the vertical space, otherwise
-		// we'll end up with un-updated rows (probably black in output??).
-
-		for (int i = 0; i < G_THREADS; i++) {
-			thread_data[i].row = i * (G_HEIGHT / G_THREADS);
-			thread_data[i].rows = (G_HEIGHT / G_THREADS);
-			thread_data[i].pixels = pixels;
-			thread_data[i].points = points;
-			thread_data[i].run = &run;
-			thread_data[i].timestep = &timestep;
-			thread_data[i].finished = &finished;
+	uint32_t *palette = calloc(G_POINTS, sizeof(*palette));
+
+	Pipeline pipe = { 0 };
+	pipe.image_name = image_name;
+
+	QueueInit(&pipe.free, G_INFLIGHT);
+	QueueInit(&pipe.drawn, G_INFLIGHT);
+	QueueInit(&pipe.encoded, G_INFLIGHT);
+
+	// NOTE (Brian) the first frame reuses the buffer main handed us, the rest get their own
+	Frame *frames = calloc(G_INFLIGHT, sizeof(*frames));
+	for (int i = 0; i < G_INFLIGHT; i++) {
+		frames[i].pixels = i == 0 ? pixels : calloc(G_WIDTH * G_HEIGHT, sizeof(*pixels));
+		frames[i].points = calloc(G_POINTS, sizeof(*points));
+		assert(frames[i].pixels != NULL && frames[i].points != NULL);
+		QueuePush(&pipe.free, frames + i);
+	}
+
+	FrameJob job = { 0 };
+	job.labels = labels;
+	job.palette = palette;
+	job.points = points;
+
+	PoolStart(G_THREADS);
+
+	// NOTE (Brian) nothing has written to these yet, so this is what decides where their pages live
+	for (int i = 0; i < G_INFLIGHT; i++)
+		PoolFirstTouch(frames[i].pixels, G_WIDTH * G_HEIGHT * sizeof(*pixels));
+	PoolFirstTouch(labels, G_WIDTH * G_HEIGHT * sizeof(*labels));
+
+	if (G_Lloyd)
+		LloydInit(PoolSize(), G_POINTS);
+	if (G_Collide)
+		CollideInit(PoolSize(), G_POINTS);
+	if (G_Force != 0)
+		ForceInit(PoolSize(), G_POINTS);
+
+	void *encoder = ThreadStart(EncodeStage, &pipe);
+	void *sink = ThreadStart(SinkStage, &pipe);
+
+	// the simulation runs on the structure of arrays, points gets copied back out for the engines
+	PointSet set;
+	PointSetInit(&set, G_POINTS);
+	PointSetLoad(&set, points, 0, G_POINTS);
+	G_PointSet = &set;
+
+	// where the points are going next, for the blur
+	Point *next = calloc(G_POINTS, sizeof(*next));
+	assert(next != NULL);
+
+	double raster_time = 0, wait_time = 0;
+	double moved_first = 0, moved_mean = 0, moved_max = 0;
+	double start = GetTime();
+	int t;
+
+	for (t = 0; t < G_TIMESTEPS && !atomic_load(&pipe.failed); t++) {
+		printf("\rTimestep %d", t);
+
+		double waited = GetTime();
+		Frame *frame = QueuePop(&pipe.free);
+		wait_time += GetTime() - waited;
+
+		double raster = GetTime();
+
+		frame->timestep = t;
+		memcpy(frame->points, points, G_POINTS * sizeof(*points));
+		job.pixels = frame->pixels;
+
+		// every phase is handed out to all of the threads, and has to be done before the next one,
+		// and the last one turns the labels into colors
+		if (G_Blur > 1) {
+			// NOTE (Brian) the blur works straight from the points, so the engine has nothing to do
+			memcpy(next, points, G_POINTS * sizeof(*points));
+			for (int i = 0; i < G_POINTS; i++)
+				MovePoint(next + i);
+			BlurBegin(points, next, G_POINTS);
+			job.phases = 0;
+		} else {
+			job.phases = G_Engine->Begin(labels, points, G_POINTS);
 		}
 
-		for (int i = 0; i < G_THREADS; i++) {
-			threads[i] = CreateThread(NULL, 0, MultiPaintThreadProc, thread_data + i, 0, NULL);
-			assert(threads[i] != NULL);
+		BuildPalette(palette, points, G_POINTS, 0);
+
+		SchedRun(MultiPaintTile, &job, job.phases + 1);
+
+		StepJob step = { frame->pixels, frame->points, points, &set };
+		PoolRun(StepPoints, &step);
+
+		raster = GetTime() - raster;
+		raster_time += raster;
+
+		if (G_Lloyd) {
+			LloydMoved(&moved_mean, &moved_max);
+			if (t == 0)
+				moved_first = moved_mean;
+			printf("\rTimestep %d  moved %9.4fpx avg %9.4fpx max  %8.3fms", t, moved_mean, moved_max, raster * 1000);
 		}
+
+		QueuePush(&pipe.drawn, frame);
 	}
 
-	run = true;
+	QueuePush(&pipe.drawn, NULL);
+	ThreadJoin(encoder);
+	ThreadJoin(sink);
 
-	for (int t = 0; t < G_TIMESTEPS; t++) {
+	double elapsed = GetTime() - start;
+
+	printf("\n");
+	if (t > 0) {
+		printf("  Pipeline      %d frames in flight, %.3fms per frame, %.1f fps\n",
+			G_INFLIGHT, elapsed * 1000 / t, t / elapsed);
+		printf("  Stages        raster and step %.3fms  encode %.3fms  sink %.3fms  (%.3fms one after another)\n",
+			raster_time * 1000 / t, pipe.encode_time * 1000 / t, pipe.sink_time * 1000 / t,
+			(raster_time + pipe.encode_time + pipe.sink_time) * 1000 / t);
+		printf("  Stalled       %.3fms per frame waiting on a free buffer\n", wait_time * 1000 / t);
+	}
+	if (t > 0 && G_Lloyd) {
+		printf("  Lloyd         %d iterations, %.3fms each, %.3fms of that reducing, moved %.4fpx at first and %.4fpx last\n",
+			t, raster_time * 1000 / t, LloydReduceTime() * 1000 / t, moved_first, moved_mean);
+		LloydFree();
+	}
+	if (G_Collide) {
+		CollideReport();
+		CollideFree();
+	}
+	if (G_Force != 0) {
+		ForceReport();
+		ForceFree();
+	}
+	BlurReport();
+	SchedReport();
+
+	PoolStop();
+
+	for (int i = 0; i < G_INFLIGHT; i++) {
+		if (frames[i].pixels != pixels)
+			free(frames[i].pixels);
+		free(frames[i].points);
+		free(frames[i].bmp);
+	}
+	free(frames);
+
+	QueueFree(&pipe.free);
+	QueueFree(&pipe.drawn);
+	QueueFree(&pipe.encoded);
+
+	G_PointSet = NULL;
+	PointSetFree(&set);
+
+	free(next);
+	free(palette);
+}
+
+// FrameWorkers: the queues around every worker in frame parallel mode. Timestep t always goes to
+// worker t % workers, so the sink gets the frames back in order just by going around the workers.
+typedef struct {
+	Queue *free; // sink -> simulation
+	Queue *todo; // simulation -> worker
+	Queue *done; // worker -> sink
+	Point *points; // the simulation, only FrameSimulate touches it
+	Pipeline *pipe;
+	double *render_time; // by worker
+	double *encode_time;
+	double sim_time;
+	int frames;
+} FrameWorkers;
+
+// FrameSimulate: runs the points ahead of the workers, handing each one a snapshot for every
+// timestep it's going to draw
+static void FrameSimulate(void *arg)
+{
+	FrameWorkers *fw = arg;
+	int workers = PoolSize();
+	int t;
+
+	for (t = 0; t < G_TIMESTEPS && !atomic_load(&fw->pipe->failed); t++) {
+		Frame *frame = QueuePop(fw->free + t % workers);
+
+		double start = GetTime();
+
+		frame->timestep = t;
+		memcpy(frame->points, fw->points, G_POINTS * sizeof(*fw->points));
+		for (int i = 0; i < G_POINTS; i++)
+			MovePoint(fw->points + i);
+
+		fw->sim_time += GetTime() - start;
+
+		QueuePush(fw->todo + t % workers, frame);
+	}
+
+	fw->frames = t;
+
+	for (int w = 0; w < workers; w++)
+		QueuePush(fw->todo + w, NULL);
+}
+
+// FrameSink: writes the frames out in timestep order, whichever worker finished first
+static void FrameSink(void *arg)
+{
+	FrameWorkers *fw = arg;
+	int workers = PoolSize();
+	Frame *frame;
+
+	for (int t = 0; (frame = QueuePop(fw->done + t % workers)) != NULL; t++) {
+		assert(frame->timestep == t);
 		printf("\rTimestep %d", t);
 
-		InterlockedExchange((LONG *)&finished, 0);
-		InterlockedIncrement((LONG *)&timestep);
+		SinkFrame(fw->pipe, frame);
+
+		QueuePush(fw->free + t % workers, frame);
+	}
+}
+
+// FrameWorker: draws and encodes whole frames, one after another, with its own labels and palette
+static void FrameWorker(void *arg, int worker, int workers)
+{
+	FrameWorkers *fw = arg;
+	Label *labels = malloc((size_t)G_WIDTH * G_HEIGHT * sizeof(*labels));
+	uint32_t *palette = malloc(G_POINTS * sizeof(*palette));
+	assert(labels != NULL && palette != NULL);
 
-		while (InterlockedCompareExchange((LONG *)&finished, G_THREADS, 0) != G_THREADS)
-			;
+	Frame *frame;
 
-		for (int i = 0; i < G_POINTS; i++) {
-			DrawPoint(pixels, points[i].px, points[i].py);
+	while ((frame = QueuePop(fw->todo + worker)) != NULL) {
+		Point *points = frame->points;
+		double start = GetTime();
+
+		for (int y = 0; y < G_HEIGHT; y++)
+			G_Metric->Row(labels + G_WIDTH * y, 0, G_WIDTH, y, points, G_POINTS);
+
+		BuildPalette(palette, points, G_POINTS, 0);
+
+		if (G_AA)
+			ResolveAA(frame->pixels, labels, palette, points, 0, 0, G_WIDTH, G_HEIGHT);
+		else
+			ResolvePalette(frame->pixels, labels, palette, 0, 0, G_WIDTH, G_HEIGHT);
+
+		for (int i = 0; i < G_POINTS; i++)
+			DrawPoint(frame->pixels, points[i].px, points[i].py, 0, G_HEIGHT);
+
+		double encode = GetTime();
+		fw->render_time[worker] += encode - start;
+
+		EncodeFrame(frame);
+		fw->encode_time[worker] += GetTime() - encode;
+
+		QueuePush(fw->done + worker, frame);
+	}
+
+	QueuePush(fw->done + worker, NULL);
+
+	free(palette);
+	free(labels);
+}
+
+// FrameParallel: every worker draws and encodes whole frames of its own, while one thread runs
+// the simulation ahead of them and another writes the results out in order. For offline renders
+// at small resolutions, where one frame isn't enough work to split between all of the cores.
+//
+// NOTE (Brian) the engines keep the frame they're working on in globals, so only the brute force
+// metric kernels, which take everything as arguments, can have more than one frame going at once
+void FrameParallel(Pixel *pixels, Point *points)
+{
+	char image_name[256] = { 0 };
+	snprintf(image_name, sizeof image_name, "%s.bmp", TEMPLATE_NAME);
+
+	Pipeline pipe = { 0 };
+	pipe.image_name = image_name;
+
+	PoolStart(G_THREADS);
+
+	int workers = PoolSize();
+
+	FrameWorkers fw = { 0 };
+	fw.points = points;
+	fw.pipe = &pipe;
+	fw.free = calloc(workers, sizeof(*fw.free));
+	fw.todo = calloc(workers, sizeof(*fw.todo));
+	fw.done = calloc(workers, sizeof(*fw.done));
+	fw.render_time = calloc(workers, sizeof(*fw.render_time));
+	fw.encode_time = calloc(workers, sizeof(*fw.encode_time));
+	assert(fw.free != NULL && fw.todo != NULL && fw.done != NULL);
+	assert(fw.render_time != NULL && fw.encode_time != NULL);
+
+	// NOTE (Brian) every worker gets G_INFLIGHT frames, and calloc hands back untouched pages for
+	// buffers this big, so the first write to them is the worker's own and they land on its node
+	Frame *frames = calloc(workers * G_INFLIGHT, sizeof(*frames));
+	assert(frames != NULL);
+
+	for (int w = 0; w < workers; w++) {
+		QueueInit(fw.free + w, G_INFLIGHT);
+		QueueInit(fw.todo + w, G_INFLIGHT + 1);
+		QueueInit(fw.done + w, G_INFLIGHT + 1);
+
+		for (int i = 0; i < G_INFLIGHT; i++) {
+			Frame *frame = frames + w * G_INFLIGHT + i;
+			frame->pixels = frame == frames ? pixels : calloc(G_WIDTH * G_HEIGHT, sizeof(*pixels));
+			frame->points = calloc(G_POINTS, sizeof(*points));
+			assert(frame->pixels != NULL && frame->points != NULL);
+			QueuePush(fw.free + w, frame);
 		}
+	}
 
-		rc = stbi_write_bmp(image_name, G_WIDTH, G_HEIGHT, 4, (void *)pixels);
-		if (rc == 0) {
-			fprintf(stderr, "There was an error writing the file!");
-			exit(1);
+	// the first call picks the resolve kernel, get that out of the way before the workers race on it
+	uint32_t *palette = calloc(G_POINTS, sizeof(*palette));
+	assert(palette != NULL);
+	BuildPalette(palette, points, G_POINTS, 0);
+	free(palette);
+
+	double start = GetTime();
+
+	void *simulate = ThreadStart(FrameSimulate, &fw);
+	void *sink = ThreadStart(FrameSink, &fw);
+
+	PoolRun(FrameWorker, &fw);
+
+	ThreadJoin(simulate);
+	ThreadJoin(sink);
+
+	double elapsed = GetTime() - start;
+
+	printf("\n");
+	if (fw.frames > 0) {
+		double render = 0, encode = 0;
+		for (int w = 0; w < workers; w++) {
+			render += fw.render_time[w];
+			encode += fw.encode_time[w];
 		}
 
-		rc = UpdateWallpaper(image_name);
-		if (rc < 0) {
-			fprintf(stderr, "Could not set wallpaper...\n");
-			break;
+		int t = fw.frames;
+		printf("  Frames        %d frames on %d workers, %.3fms per frame, %.1f fps\n",
+			t, workers, elapsed * 1000 / t, t / elapsed);
+		printf("  Stages        simulate %.3fms  render %.3fms  encode %.3fms  sink %.3fms  (thread time per frame)\n",
+			fw.sim_time * 1000 / t, render * 1000 / t, encode * 1000 / t, pipe.sink_time * 1000 / t);
+	}
+
+	PoolStop();
+
+	for (int i = 0; i < workers * G_INFLIGHT; i++) {
+		if (frames[i].pixels != pixels)
+			free(frames[i].pixels);
+		free(frames[i].points);
+		free(frames[i].bmp);
+	}
+	free(frames);
+
+	for (int w = 0; w < workers; w++) {
+		QueueFree(fw.free + w);
+		QueueFree(fw.todo + w);
+		QueueFree(fw.done + w);
+	}
+	free(fw.free);
+	free(fw.todo);
+	free(fw.done);
+	free(fw.render_time);
+	free(fw.encode_time);
+}
+
+// CompareWithBrute: renders every timestep with the selected engine and with brute force, and
+// reports how many pixels the engine got wrong, by how much, and how long each one took
+void CompareWithBrute(Label *labels, Point *points)
+{
+	Label *reference = (Label *)calloc(G_WIDTH * G_HEIGHT, sizeof(*reference));
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+	size_t wrong_sum = 0, wrong_max = 0;
+	double engine_sum = 0, brute_sum = 0;
+	double error_sum = 0, error_max = 0;
+
+	for (int t = 0; t < G_TIMESTEPS; t++) {
+		double start = GetTime();
+		RenderFrame(G_Engine, labels, points);
+		double engine_time = GetTime() - start;
+
+		start = GetTime();
+		RenderFrame(&BruteEngine, reference, points);
+		double brute_time = GetTime() - start;
+
+		// for the wrong pixels, how much farther the picked point is than the right one
+		size_t wrong = 0;
+		for (size_t i = 0; i < total; i++) {
+			if (labels[i] == reference[i])
+				continue;
+
+			double x = i % G_WIDTH, y = i / G_WIDTH;
+			Point *got = points + labels[i], *want = points + reference[i];
+			double error = hypot(got->px - x, got->py - y) - hypot(want->px - x, want->py - y);
+
+			error_sum += error;
+			if (error_max < error)
+				error_max = error;
+			wrong++;
 		}
 
+		printf("Timestep %d: %zu / %zu pixels wrong (%.4f%%), %s %.3fms, brute %.3fms\n",
+			t, wrong, total, 100.0 * wrong / total, G_Engine->name, engine_time * 1000, brute_time * 1000);
+
+		wrong_sum += wrong;
+		if (wrong_max < wrong)
+			wrong_max = wrong;
+		engine_sum += engine_time;
+		brute_sum += brute_time;
+
 		for (int i = 0; i < G_POINTS; i++) {
 			MovePoint(points + i);
 		}
 	}
 
-	run = false;
-	InterlockedIncrement((LONG *)&timestep);
+	printf("%s vs brute, %d points, %d timesteps\n", G_Engine->name, G_POINTS, G_TIMESTEPS);
+	printf("  Wrong Pixels  avg %.4f%%  max %.4f%%\n",
+		100.0 * wrong_sum / ((double)total * G_TIMESTEPS), 100.0 * wrong_max / total);
+	if (wrong_sum > 0)
+		printf("  Extra Dist    avg %.4fpx  max %.4fpx\n", error_sum / wrong_sum, error_max);
+	printf("  Frame Time    %s %.3fms  brute %.3fms\n",
+		G_Engine->name, engine_sum * 1000 / G_TIMESTEPS, brute_sum * 1000 / G_TIMESTEPS);
 
-	for (int i = 0; i < G_THREADS; i++)
-		WaitForSingleObject(threads[i], INFINITE);
+	if (G_Engine->Report != NULL)
+		G_Engine->Report();
 
-	free(thread_data);
+	free(reference);
+}
+
+void Usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-engine NAME] [-metric NAME] [-p P] [-points N] [-timesteps N] [-threads N] [-tile N] [-inflight N] [-perframe] [-lloyd] [-collide R] [-force G] [-theta T] [-blur K] [-seed N] [-seek T] [-pin none|core|node] [-barrier central|dissemination] [-tune] [-aa] [-compare] [-bench NAME] [-svg FILE]\n", prog);
+	fprintf(stderr, "engines:");
+	for (int i = 0; i < ARRSIZE(G_Engines); i++)
+		fprintf(stderr, " %s", G_Engines[i]->name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "metrics:");
+	for (int i = 0; i < G_MetricsLen; i++)
+		fprintf(stderr, " %s", G_Metrics[i]->name);
+	fprintf(stderr, " (the metric engine only, -p is the minkowski power)\n");
+	fprintf(stderr, "benchmarks: kernel palette metric aa blur pool barrier sched scaling trajectory step collide force\n");
+	exit(1);
 }
 
 int main(int argc, char **argv)
 {
-	int rc;
+	bool compare = false;
+	bool tune = false;
+	bool perframe = false;
+	int64_t seek = 0;
+	bool tuned = false; // threads or tile size given on the command line
+	char *bench = NULL;
 
 	// TODO (Brian) Get the screen resolution by calling Windows
 	G_WIDTH = 1280;
 	G_HEIGHT = 720;
 	G_TIMESTEPS = 1000; // :)
-
-	SeedRNG();
+	G_THREADS = PoolCPUCount();
 
 	// G_POINTS = RandBound(14) + 5;
 	G_POINTS = 6;
 
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-engine") == 0 && i + 1 < argc) {
+			char *name = argv[++i];
+			G_Engine = NULL;
+			for (int j = 0; j < ARRSIZE(G_Engines); j++) {
+				if (strcmp(G_Engines[j]->name, name) == 0)
+					G_Engine = G_Engines[j];
+			}
+			if (G_Engine == NULL)
+				Usage(argv[0]);
+		} else if (strcmp(argv[i], "-metric") == 0 && i + 1 < argc) {
+			char *name = argv[++i];
+			G_Metric = NULL;
+			for (int j = 0; j < G_MetricsLen; j++) {
+				if (strcmp(G_Metrics[j]->name, name) == 0)
+					G_Metric = G_Metrics[j];
+			}
+			if (G_Metric == NULL)
+				Usage(argv[0]);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			G_MinkowskiP = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-points") == 0 && i + 1 < argc) {
+			G_POINTS = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-timesteps") == 0 && i + 1 < argc) {
+			G_TIMESTEPS = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+			G_THREADS = atoi(argv[++i]);
+			tuned = true;
+		} else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc) {
+			G_TileSize = atoi(argv[++i]);
+			tuned = true;
+		} else if (strcmp(argv[i], "-inflight") == 0 && i + 1 < argc) {
+			G_INFLIGHT = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-pin") == 0 && i + 1 < argc) {
+			char *pin = argv[++i];
+			if (strcmp(pin, "none") == 0)
+				G_Pin = PIN_NONE;
+			else if (strcmp(pin, "core") == 0)
+				G_Pin = PIN_CORE;
+			else if (strcmp(pin, "node") == 0)
+				G_Pin = PIN_NODE;
+			else
+				Usage(argv[0]);
+		} else if (strcmp(argv[i], "-barrier") == 0 && i + 1 < argc) {
+			char *barrier = argv[++i];
+			if (strcmp(barrier, "central") == 0)
+				G_Barrier = BARRIER_CENTRAL;
+			else if (strcmp(barrier, "dissemination") == 0)
+				G_Barrier = BARRIER_DISSEMINATION;
+			else
+				Usage(argv[0]);
+		} else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			G_Seed = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-seek") == 0 && i + 1 < argc) {
+			seek = strtoll(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-blur") == 0 && i + 1 < argc) {
+			G_Blur = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-lloyd") == 0) {
+			G_Lloyd = true;
+		} else if (strcmp(argv[i], "-collide") == 0 && i + 1 < argc) {
+			G_Collide = true;
+			G_Radius = strtof(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-force") == 0 && i + 1 < argc) {
+			G_Force = strtof(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-theta") == 0 && i + 1 < argc) {
+			G_Theta = strtof(argv[++i], NULL);
+		} else if (strcmp(argv[i], "-perframe") == 0) {
+			perframe = true;
+		} else if (strcmp(argv[i], "-tune") == 0) {
+			tune = true;
+		} else if (strcmp(argv[i], "-aa") == 0) {
+			G_AA = true;
+		} else if (strcmp(argv[i], "-compare") == 0) {
+			compare = true;
+		} else if (strcmp(argv[i], "-svg") == 0 && i + 1 < argc) {
+			G_SVG = argv[++i];
+		} else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc) {
+			bench = argv[++i];
+		} else {
+			Usage(argv[0]);
+		}
+	}
+
+	if (G_POINTS <= 0 || G_TIMESTEPS <= 0 || G_THREADS <= 0 || G_TileSize <= 0 || G_INFLIGHT <= 0 || G_MinkowskiP <= 0 || seek < 0 || G_Blur < 0 || !(G_Radius > 0) || !(G_Theta >= 0))
+		Usage(argv[0]);
+
+	// NOTE (Brian) every other engine leans on Euclidean geometry somewhere, so a different metric
+	// means brute force through the metric engine
+	if (G_Metric != G_Metrics[0]) {
+		if (G_Engine == &BruteEngine)
+			G_Engine = &MetricEngine;
+		if (G_Engine != &MetricEngine) {
+			fprintf(stderr, "the %s engine only does euclid distances\n", G_Engine->name);
+			exit(1);
+		}
+	}
+
+	if (G_Blur > 1 && (G_Lloyd || G_AA || perframe || G_Metric != G_Metrics[0])) {
+		fprintf(stderr, "-blur draws its own euclid sub-frames, so not with -lloyd, -aa, -perframe or -metric\n");
+		exit(1);
+	}
+
+	// NOTE (Brian) the sub-samples are picked euclid, and skipping pixels whose neighbours all agree
+	// only works when the cells are convex, which the weighted ones aren't
+	if (G_AA && G_Metric != G_Metrics[0]) {
+		fprintf(stderr, "-aa samples euclid distances, so not with -metric\n");
+		exit(1);
+	}
+
+	if ((G_Collide || G_Force != 0) && (G_Lloyd || G_Blur > 1 || perframe || seek > 0)) {
+		fprintf(stderr, "-collide and -force change where the points go next, so not with -lloyd, -blur, -perframe or -seek\n");
+		exit(1);
+	}
+
+	if (seek > 0 && G_Lloyd) {
+		fprintf(stderr, "-seek jumps along the trajectories, which -lloyd doesn't follow, so not with -lloyd\n");
+		exit(1);
+	}
+
+	if (perframe && G_Lloyd) {
+		fprintf(stderr, "-lloyd needs every frame drawn before the next one can start, so not with -perframe\n");
+		exit(1);
+	}
+
+	if (perframe && G_Engine != &BruteEngine && G_Engine != &MetricEngine) {
+		fprintf(stderr, "-perframe only works with the brute and metric engines\n");
+		exit(1);
+	}
+
+	if ((uint64_t)G_POINTS - 1 > LABEL_MAX) {
+		fprintf(stderr, "%d points don't fit in a Label, build with -DWIDE_LABELS\n", G_POINTS);
+		exit(1);
+	}
+
+	SeedRNG();
+
 	Pixel *pixels = (Pixel *)calloc(G_WIDTH * G_HEIGHT, sizeof(*pixels));
+	Label *labels = (Label *)calloc(G_WIDTH * G_HEIGHT, sizeof(*labels));
 	Point *points = (Point *)calloc(G_POINTS, sizeof(*points));
 
 	for (int i = 0; i < G_POINTS; i++)
 		GenerateRandomPoint(points + i);
 
+	// the metric benchmark runs every metric, weighted ones included
+	if (G_Metric->weighted || (bench != NULL && strcmp(bench, "metric") == 0)) {
+		for (int i = 0; i < G_POINTS; i++)
+			GenerateRandomWeight(points + i);
+	}
+
+	// with the same -seed, this picks up exactly where a run that went seek timesteps left off
+	for (int i = 0; i < G_POINTS && seek > 0; i++)
+		PointAt(points + i, seek);
+
+	// NOTE (Brian) anything given on the command line wins over what was tuned before
+	if (tune)
+		Tune(G_Engine, points, G_POINTS);
+	else if (!tuned && TuneLoad(G_Engine))
+		printf("Using tuned settings, %d threads and %dx%d tiles\n", G_THREADS, G_TileSize, G_TileSize);
+
+	if (bench != NULL) {
+		if (strcmp(bench, "kernel") == 0)
+			BenchKernel(points, G_POINTS);
+		else if (strcmp(bench, "palette") == 0)
+			BenchPalette(G_Engine, points, G_POINTS);
+		else if (strcmp(bench, "metric") == 0)
+			BenchMetrics(points, G_POINTS);
+		else if (strcmp(bench, "aa") == 0)
+			BenchAA(G_Engine, points, G_POINTS);
+		else if (strcmp(bench, "blur") == 0)
+			BenchBlur(points, G_POINTS);
+		else if (strcmp(bench, "pool") == 0)
+			BenchPool(G_THREADS);
+		else if (strcmp(bench, "barrier") == 0)
+			BenchBarrier(G_THREADS);
+		else if (strcmp(bench, "sched") == 0)
+			BenchSched(G_Engine, points, G_POINTS, G_THREADS);
+		else if (strcmp(bench, "scaling") == 0)
+			BenchScaling(G_Engine, points, G_POINTS, G_THREADS);
+		else if (strcmp(bench, "trajectory") == 0)
+			BenchTrajectory(points, G_POINTS);
+		else if (strcmp(bench, "step") == 0)
+			BenchStep(points, G_POINTS, G_THREADS);
+		else if (strcmp(bench, "collide") == 0)
+			BenchCollide(G_THREADS);
+		else if (strcmp(bench, "force") == 0)
+			BenchForce(G_THREADS);
+		else
+			Usage(argv[0]);
+	} else if (compare) {
+		CompareWithBrute(labels, points);
+	} else if (perframe) {
+		FrameParallel(pixels, points);
+	} else {
 #if 0
-	SingleThreaded(pixels, points);
+		SingleThreaded(pixels, labels, points);
 #else
-	MultiThreaded(pixels, points);
+		MultiThreaded(pixels, labels, points);
 #endif
+	}
 
 	free(points);
+	free(labels);
 	free(pixels);
 
 	return 0;
@@ -0,0 +1,125 @@
+// Brian Chrzanowski
+// Distance Metrics
+//
+// Brute force under some other idea of distance: Manhattan, Chebyshev, Minkowski with any power,
+// additively weighted (every point's distance has its weight taken off, so heavy points grow
+// curved cells) and power diagrams (the weight squared comes off the squared distance, so the
+// edges stay straight). The metric expressions live in voronoi.h next to NEAREST_POINT, and
+// METRIC_KERNEL stamps out a row kernel for each one, so the choice of metric is made once per row
+// instead of once per point.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+float G_MinkowskiP = 3.0f;
+
+#define METRIC_KERNEL(NAME, METRIC) \
+	static void NAME(Label *row, int x0, int x1, int y, Point *points, int points_len) \
+	{ \
+		for (int x = x0; x < x1; x++) { \
+			int picked; \
+			NEAREST_POINT(METRIC, picked, x, y, points, points_len); \
+			assert(picked >= 0); \
+			row[x] = (Label)picked; \
+		} \
+	}
+
+METRIC_KERNEL(EuclidRow, METRIC_EUCLID)
+METRIC_KERNEL(ManhattanRow, METRIC_MANHATTAN)
+METRIC_KERNEL(ChebyshevRow, METRIC_CHEBYSHEV)
+METRIC_KERNEL(MinkowskiRow, METRIC_MINKOWSKI)
+METRIC_KERNEL(WeightedRow, METRIC_WEIGHTED)
+METRIC_KERNEL(PowerRow, METRIC_POWER)
+
+static Metric EuclidMetric = { "euclid", EuclidRow };
+static Metric ManhattanMetric = { "manhattan", ManhattanRow };
+static Metric ChebyshevMetric = { "chebyshev", ChebyshevRow };
+static Metric MinkowskiMetric = { "minkowski", MinkowskiRow };
+static Metric WeightedMetric = { "weighted", WeightedRow, true };
+static Metric PowerMetric = { "power", PowerRow, true };
+
+// NOTE (Brian) the first one is the default, and the only one the other engines can do
+Metric *G_Metrics[] = {
+	&EuclidMetric,
+	&ManhattanMetric,
+	&ChebyshevMetric,
+	&MinkowskiMetric,
+	&WeightedMetric,
+	&PowerMetric,
+};
+
+int G_MetricsLen = sizeof(G_Metrics) / sizeof(G_Metrics[0]);
+
+Metric *G_Metric = &EuclidMetric;
+
+static Label *metric_labels;
+static Point *metric_points;
+static int metric_points_len;
+
+static int MetricBegin(Label *labels, Point *points, int points_len)
+{
+	metric_labels = labels;
+	metric_points = points;
+	metric_points_len = points_len;
+	return 1;
+}
+
+static void MetricPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++)
+		G_Metric->Row(metric_labels + G_WIDTH * y, x0, x1, y, metric_points, metric_points_len);
+}
+
+Engine MetricEngine = { "metric", MetricBegin, MetricPhase };
+
+// BenchMetrics: times a whole frame with UpdatePixelForPoints and with every metric's kernel
+void BenchMetrics(Point *points, int points_len)
+{
+	const int frames = 5;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	Label *reference = calloc(total, sizeof(*reference));
+	Label *labels = calloc(total, sizeof(*labels));
+	assert(reference != NULL && labels != NULL);
+
+	double start = GetTime();
+	for (int f = 0; f < frames; f++) {
+		for (int y = 0; y < G_HEIGHT; y++) {
+			for (int x = 0; x < G_WIDTH; x++) {
+				UpdatePixelForPoints(reference + (x + G_WIDTH * y), x, y, points, points_len);
+			}
+		}
+	}
+	double base = (GetTime() - start) / frames;
+
+	printf("%d points, %dx%d, %d frames, minkowski p = %g\n", points_len, G_WIDTH, G_HEIGHT, frames, G_MinkowskiP);
+	printf("  %-22s %8.3fms %8.1f Mpix/s\n", "UpdatePixelForPoints", base * 1000, total / base / 1e6);
+
+	for (int i = 0; i < G_MetricsLen; i++) {
+		Metric *metric = G_Metrics[i];
+
+		start = GetTime();
+		for (int f = 0; f < frames; f++) {
+			for (int y = 0; y < G_HEIGHT; y++)
+				metric->Row(labels + G_WIDTH * y, 0, G_WIDTH, y, points, points_len);
+		}
+		double elapsed = (GetTime() - start) / frames;
+
+		// the cells are different shapes, so count how many pixels changed owner from euclid
+		size_t moved = 0;
+		for (size_t j = 0; j < total; j++)
+			moved += labels[j] != reference[j];
+
+		printf("  %-22s %8.3fms %8.1f Mpix/s %6.2fx  %6.2f%% of pixels differ from euclid\n", metric->name,
+			elapsed * 1000, total / elapsed / 1e6, base / elapsed, 100.0 * moved / total);
+	}
+
+	free(labels);
+	free(reference);
+}
@@ -0,0 +1,134 @@
+// Brian Chrzanowski
+// Labels and Palettes
+//
+// Engines only write which point owns each pixel. The colors are looked up afterwards by
+// ResolvePalette, one pass over the labels with no distance math, so recoloring a frame (cycling
+// the palette around, or a different skew color) doesn't need the frame rasterized again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PALETTE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "voronoi.h"
+
+typedef void (*ResolveRowFunc)(Pixel *row, Label *labels, uint32_t *palette, int n);
+
+static ResolveRowFunc palette_resolve;
+
+// FillLabels: sets a run of n labels
+void FillLabels(Label *labels, Label label, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+#ifdef WIDE_LABELS
+	__m128i v = _mm_set1_epi32((int)label);
+#else
+	__m128i v = _mm_set1_epi16((short)label);
+#endif
+	for (; i + (int)(sizeof(v) / sizeof(*labels)) <= n; i += sizeof(v) / sizeof(*labels))
+		_mm_storeu_si128((__m128i *)(labels + i), v);
+#endif
+
+	for (; i < n; i++)
+		labels[i] = label;
+}
+
+static void ResolveRowScalar(Pixel *row, Label *labels, uint32_t *palette, int n)
+{
+	for (int i = 0; i < n; i++)
+		row[i].color = palette[labels[i]];
+}
+
+#ifdef PALETTE_X86
+__attribute__((target("avx2")))
+static void ResolveRowAVX2(Pixel *row, Label *labels, uint32_t *palette, int n)
+{
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+#ifdef WIDE_LABELS
+		__m256i idx = _mm256_loadu_si256((__m256i *)(labels + i));
+#else
+		__m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(labels + i)));
+#endif
+		__m256i colors = _mm256_i32gather_epi32((const int *)palette, idx, 4);
+		_mm256_storeu_si256((__m256i *)(row + i), colors);
+	}
+
+	for (; i < n; i++)
+		row[i].color = palette[labels[i]];
+}
+#endif
+
+// BuildPalette: the colors of the points, rotated by shift places, which is how palette cycling works
+void BuildPalette(uint32_t *palette, Point *points, int points_len, int shift)
+{
+	if (palette_resolve == NULL) {
+		palette_resolve = ResolveRowScalar;
+#ifdef PALETTE_X86
+		if (SIMDLevel() >= 1)
+			palette_resolve = ResolveRowAVX2;
+#endif
+	}
+
+	shift %= points_len;
+	if (shift < 0)
+		shift += points_len;
+
+	for (int i = 0; i < points_len; i++) {
+		int j = i + shift < points_len ? i + shift : i + shift - points_len;
+		palette[i] = points[j].color;
+	}
+}
+
+// ResolvePalette: turns the labels in [x0, x1) x [y0, y1) into colors, call BuildPalette first
+void ResolvePalette(Pixel *pixels, Label *labels, uint32_t *palette, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		size_t row = x0 + (size_t)G_WIDTH * y;
+		palette_resolve(pixels + row, labels + row, palette, x1 - x0);
+	}
+}
+
+// BenchPalette: compares rasterizing a frame with just recoloring it from the labels
+void BenchPalette(Engine *engine, Point *points, int points_len)
+{
+	const int frames = 20;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	Label *labels = calloc(total, sizeof(*labels));
+	Pixel *pixels = calloc(total, sizeof(*pixels));
+	uint32_t *palette = malloc(points_len * sizeof(*palette));
+	assert(labels != NULL && pixels != NULL && palette != NULL);
+
+	BuildPalette(palette, points, points_len, 0);
+
+	double start = GetTime();
+	for (int f = 0; f < frames; f++)
+		RenderFrame(engine, labels, points);
+	double raster = (GetTime() - start) / frames;
+
+	start = GetTime();
+	for (int f = 0; f < frames; f++) {
+		BuildPalette(palette, points, points_len, f);
+		ResolvePalette(pixels, labels, palette, 0, 0, G_WIDTH, G_HEIGHT);
+	}
+	double resolve = (GetTime() - start) / frames;
+
+	printf("%s, %d points, %dx%d, %d frames\n", engine->name, points_len, G_WIDTH, G_HEIGHT, frames);
+	printf("  Rasterize     %8.3fms  %zu bytes per pixel written\n", raster * 1000, sizeof(*labels));
+	printf("  Recolor       %8.3fms  %.1f GB/s\n", resolve * 1000,
+		total * (sizeof(*labels) + sizeof(*pixels)) / resolve / 1e9);
+	printf("  Recoloring is %.1fx cheaper than rasterizing again\n", raster / resolve);
+
+	free(palette);
+	free(pixels);
+	free(labels);
+}
@@ -0,0 +1,266 @@
+// Brian Chrzanowski
+// Point Storage
+//
+// The simulation keeps its points as a structure of arrays: every field in its own cache line
+// aligned array, so stepping a million points streams through six arrays of floats instead of
+// hopping over 32 byte Points, and 8 of them fit in one AVX2 register. The walls are handled with
+// compare masks: turning a point around is multiplying by -1, which only flips the sign bit, so it's
+// an xor with the sign bit wherever the mask is set, and there are no branches left.
+//
+// Both kernels do the same float math in the same order as MovePoint, so they give exactly the same
+// points. Engines that want a structure of arrays (the simd one) read px and py straight out of
+// G_PointSet, everything else still gets Points copied back out with PointSetStore.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define POINTS_X86 1
+#include <immintrin.h>
+#endif
+
+#include "voronoi.h"
+
+PointSet *G_PointSet;
+
+typedef void (*StepFunc)(PointSet *set, int lo, int hi);
+
+static StepFunc points_step;
+
+static StepFunc StepKernel(int level);
+
+// PointSetInit: room for len points, all zero
+void PointSetInit(PointSet *set, int len)
+{
+	// NOTE (Brian) every array is padded out to a whole number of cache lines
+	int cap = (len + 15) & ~15;
+	float *arrays[6];
+
+	set->alloc = calloc(1, 6 * cap * sizeof(float) + 64);
+	assert(set->alloc != NULL);
+
+	float *base = (float *)(((uintptr_t)set->alloc + 63) & ~(uintptr_t)63);
+	for (int i = 0; i < 6; i++)
+		arrays[i] = base + i * cap;
+
+	set->px = arrays[0];
+	set->py = arrays[1];
+	set->vx = arrays[2];
+	set->vy = arrays[3];
+	set->ax = arrays[4];
+	set->ay = arrays[5];
+	set->len = len;
+
+	// NOTE (Brian) picked here, on whoever makes the set, so the workers stepping it never race on it
+	if (points_step == NULL)
+		points_step = StepKernel(SIMDLevel());
+}
+
+void PointSetFree(PointSet *set)
+{
+	free(set->alloc);
+	memset(set, 0, sizeof(*set));
+}
+
+// PointSetLoad: copies the motion of points [lo, hi) into the set
+void PointSetLoad(PointSet *set, Point *points, int lo, int hi)
+{
+	for (int i = lo; i < hi; i++) {
+		set->px[i] = points[i].px;
+		set->py[i] = points[i].py;
+		set->vx[i] = points[i].vx;
+		set->vy[i] = points[i].vy;
+		set->ax[i] = points[i].ax;
+		set->ay[i] = points[i].ay;
+	}
+}
+
+// PointSetStore: copies the motion of points [lo, hi) back out, the weights and colors are left alone
+void PointSetStore(PointSet *set, Point *points, int lo, int hi)
+{
+	for (int i = lo; i < hi; i++) {
+		points[i].px = set->px[i];
+		points[i].py = set->py[i];
+		points[i].vx = set->vx[i];
+		points[i].vy = set->vy[i];
+		points[i].ax = set->ax[i];
+		points[i].ay = set->ay[i];
+	}
+}
+
+// StepScalar: MovePoint, with selects instead of branches so the compiler can do what it likes
+static void StepScalar(PointSet *set, int lo, int hi)
+{
+	float w = G_WIDTH, h = G_HEIGHT;
+
+	for (int i = lo; i < hi; i++) {
+		float fy = (set->py[i] <= 0) | (set->py[i] >= h) ? -1.0f : 1.0f;
+		float fx = (set->px[i] <= 0) | (set->px[i] >= w) ? -1.0f : 1.0f;
+
+		set->ay[i] *= fy;
+		set->vy[i] *= fy;
+		set->ax[i] *= fx;
+		set->vx[i] *= fx;
+
+		set->vx[i] += set->ax[i];
+		set->vy[i] += set->ay[i];
+
+		set->px[i] += set->vx[i];
+		set->py[i] += set->vy[i];
+	}
+}
+
+#ifdef POINTS_X86
+
+__attribute__((target("avx2")))
+static void StepAVX2(PointSet *set, int lo, int hi)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 w = _mm256_set1_ps((float)G_WIDTH);
+	const __m256 h = _mm256_set1_ps((float)G_HEIGHT);
+	int i = lo;
+
+	for (; i + 8 <= hi; i += 8) {
+		__m256 px = _mm256_loadu_ps(set->px + i);
+		__m256 py = _mm256_loadu_ps(set->py + i);
+		__m256 vx = _mm256_loadu_ps(set->vx + i);
+		__m256 vy = _mm256_loadu_ps(set->vy + i);
+		__m256 ax = _mm256_loadu_ps(set->ax + i);
+		__m256 ay = _mm256_loadu_ps(set->ay + i);
+
+		// ordered compares, so a NaN is never out of bounds, same as OOB in MovePoint
+		__m256 oy = _mm256_or_ps(_mm256_cmp_ps(py, zero, _CMP_LE_OQ), _mm256_cmp_ps(py, h, _CMP_GE_OQ));
+		__m256 ox = _mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LE_OQ), _mm256_cmp_ps(px, w, _CMP_GE_OQ));
+		__m256 flipy = _mm256_and_ps(oy, sign);
+		__m256 flipx = _mm256_and_ps(ox, sign);
+
+		ay = _mm256_xor_ps(ay, flipy);
+		vy = _mm256_xor_ps(vy, flipy);
+		ax = _mm256_xor_ps(ax, flipx);
+		vx = _mm256_xor_ps(vx, flipx);
+
+		vx = _mm256_add_ps(vx, ax);
+		vy = _mm256_add_ps(vy, ay);
+
+		px = _mm256_add_ps(px, vx);
+		py = _mm256_add_ps(py, vy);
+
+		_mm256_storeu_ps(set->px + i, px);
+		_mm256_storeu_ps(set->py + i, py);
+		_mm256_storeu_ps(set->vx + i, vx);
+		_mm256_storeu_ps(set->vy + i, vy);
+		_mm256_storeu_ps(set->ax + i, ax);
+		_mm256_storeu_ps(set->ay + i, ay);
+	}
+
+	StepScalar(set, i, hi);
+}
+
+#endif // POINTS_X86
+
+static StepFunc StepKernel(int level)
+{
+#ifdef POINTS_X86
+	if (level >= 1)
+		return StepAVX2;
+#endif
+	return StepScalar;
+}
+
+// PointSetStep: MovePoint on points [lo, hi) of the set, which has to have come from PointSetInit
+void PointSetStep(PointSet *set, int lo, int hi)
+{
+	points_step(set, lo, hi);
+}
+
+typedef struct {
+	PointSet *set;
+	int steps;
+} StepBenchJob;
+
+static void StepBenchWork(void *arg, int worker, int workers)
+{
+	StepBenchJob *job = arg;
+	int lo = (int)((int64_t)job->set->len * worker / workers);
+	int hi = (int)((int64_t)job->set->len * (worker + 1) / workers);
+
+	for (int s = 0; s < job->steps; s++)
+		points_step(job->set, lo, hi);
+}
+
+// BenchStep: updates per second for MovePoint over Points and for each step kernel over a set, with
+// points repeated out to a million or so, checking the kernels against MovePoint
+void BenchStep(Point *points, int points_len, int threads)
+{
+	const int len = 1 << 20;
+	const int steps = 20;
+
+	Point *aos = malloc(len * sizeof(*aos));
+	Point *check = malloc(len * sizeof(*check));
+	assert(aos != NULL && check != NULL);
+
+	for (int i = 0; i < len; i++)
+		aos[i] = points[i % points_len];
+
+	PointSet set;
+	PointSetInit(&set, len);
+
+	printf("%d points, %d steps\n", len, steps);
+
+	double start = GetTime();
+	for (int s = 0; s < steps; s++) {
+		for (int i = 0; i < len; i++)
+			MovePoint(aos + i);
+	}
+	double base = GetTime() - start;
+
+	printf("  %-22s %8.1f M updates/s\n", "MovePoint", (double)len * steps / base / 1e6);
+
+	char *names[] = { "soa scalar", "soa avx2" };
+	int level = SIMDLevel();
+
+	for (int k = 0; k <= (level >= 1); k++) {
+		points_step = StepKernel(k);
+
+		// start over from the same points MovePoint started from
+		for (int i = 0; i < len; i++)
+			check[i] = points[i % points_len];
+		PointSetLoad(&set, check, 0, len);
+
+		start = GetTime();
+		for (int s = 0; s < steps; s++)
+			points_step(&set, 0, len);
+		double elapsed = GetTime() - start;
+
+		PointSetStore(&set, check, 0, len);
+		size_t differ = 0;
+		for (int i = 0; i < len; i++)
+			differ += memcmp(check + i, aos + i, sizeof(*check)) != 0;
+
+		printf("  %-22s %8.1f M updates/s  %6.2fx  %zu differ from MovePoint\n", names[k],
+			(double)len * steps / elapsed / 1e6, base / elapsed, differ);
+	}
+
+	points_step = StepKernel(level);
+
+	PoolStart(threads);
+
+	StepBenchJob job = { &set, steps };
+	PoolRun(StepBenchWork, &job);
+
+	start = GetTime();
+	PoolRun(StepBenchWork, &job);
+	double elapsed = GetTime() - start;
+
+	printf("  %-22s %8.1f M updates/s on %d threads, %.1f M per thread\n", "pool",
+		(double)len * steps / elapsed / 1e6, threads, (double)len * steps / elapsed / 1e6 / threads);
+
+	PoolStop();
+
+	PointSetFree(&set);
+	free(check);
+	free(aos);
+}
@@ -0,0 +1,634 @@
+// Brian Chrzanowski
+// Worker Pool
+//
+// PoolRun hands one function to every worker and returns once they've all finished it. The caller
+// is worker 0, so it does its share of the work instead of just watching the others.
+//
+// Anything that waits (a worker waiting for the next job, everyone waiting on the stragglers)
+// spins for POOL_SPIN rounds first, since the next job is usually only microseconds away, and then
+// parks in the kernel: a futex on Linux, WaitOnAddress on Windows, a condition variable anywhere
+// else. Whoever changes the value only makes the wake call when someone is actually parked, so a
+// busy pool never goes into the kernel at all, and an idle one doesn't burn any cores.
+//
+// With G_Pin set, every worker (the caller too, until PoolStop) is pinned to one core or to the
+// cores of one NUMA node. Workers are laid out node by node, so neighbouring workers, which get
+// neighbouring parts of the frame, sit on the same node, and PoolFirstTouch has each worker fault in
+// its own part of a buffer so the pages end up in that node's memory.
+//
+// The end of a job is a barrier (G_Barrier picks which kind) over all of the workers, and a job can
+// use the same barrier through PoolBarrier to split itself into steps that all have to finish before
+// the next one starts, without going back through the caller.
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "voronoi.h"
+
+// about 10-50us depending on the machine
+#define POOL_SPIN 4000
+
+static int pool_size;
+static PoolFunc pool_func;
+static void *pool_arg;
+static bool pool_stop;
+
+static atomic_int pool_generation; // bumped once for every job
+static atomic_int pool_parked; // workers asleep waiting for the next job
+static Barrier pool_barrier; // the end of every job, and PoolBarrier
+static int pool_start_generation;
+
+static atomic_llong pool_spun; // waits that ended while spinning
+static atomic_llong pool_parks; // waits that had to go to sleep
+
+#ifdef _WIN32
+static HANDLE *pool_threads;
+#else
+static pthread_t *pool_threads;
+#endif
+
+#define POOL_MAX_CPUS 1024
+
+int G_Pin = PIN_NONE;
+
+static int pool_cpus[POOL_MAX_CPUS]; // the cpus we're allowed on, node by node
+static int pool_cpu_node[POOL_MAX_CPUS];
+static int pool_cpus_len;
+static int pool_nodes;
+
+#ifdef _WIN32
+static DWORD_PTR pool_caller_mask;
+#else
+static cpu_set_t pool_caller_mask;
+#endif
+
+#if !defined(_WIN32) && !defined(__linux__)
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void PoolRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(_WIN32)
+	YieldProcessor();
+#endif
+}
+
+// PoolSleep: sleeps while *addr is still value, can return early for no reason
+static void PoolSleep(atomic_int *addr, int value)
+{
+#if defined(_WIN32)
+	WaitOnAddress((volatile VOID *)addr, &value, sizeof(value), INFINITE);
+#elif defined(__linux__)
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&pool_mutex);
+	if (atomic_load(addr) == value)
+		pthread_cond_wait(&pool_cond, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+#endif
+}
+
+// PoolWake: wakes everything sleeping on addr
+void PoolWake(atomic_int *addr)
+{
+#if defined(_WIN32)
+	WakeByAddressAll((PVOID)addr);
+#elif defined(__linux__)
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	(void)addr;
+	pthread_mutex_lock(&pool_mutex);
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_mutex);
+#endif
+}
+
+// PoolAwait: waits for *addr to stop being value, spinning first and then sleeping, counted in sleepers
+//
+// NOTE (Brian) sleepers is bumped before the last look at addr, and the waker changes addr before it
+// looks at sleepers, so at least one of them always sees the other and a wakeup can't get lost.
+void PoolAwait(atomic_int *addr, int value, atomic_int *sleepers)
+{
+	for (int i = 0; i < POOL_SPIN; i++) {
+		if (atomic_load_explicit(addr, memory_order_acquire) != value) {
+			atomic_fetch_add_explicit(&pool_spun, 1, memory_order_relaxed);
+			return;
+		}
+		PoolRelax();
+	}
+
+	atomic_fetch_add_explicit(&pool_parks, 1, memory_order_relaxed);
+
+	atomic_fetch_add(sleepers, 1);
+	while (atomic_load(addr) == value)
+		PoolSleep(addr, value);
+	atomic_fetch_sub(sleepers, 1);
+}
+
+// PoolTopology: finds the cpus and which node each one is on, the first time it's needed
+static void PoolTopology()
+{
+	if (pool_cpus_len > 0)
+		return;
+
+#ifdef _WIN32
+	ULONG highest = 0;
+	DWORD_PTR process, system;
+
+	GetNumaHighestNodeNumber(&highest);
+	GetProcessAffinityMask(GetCurrentProcess(), &process, &system);
+
+	for (ULONG node = 0; node <= highest; node++) {
+		ULONGLONG mask = 0;
+		if (!GetNumaNodeProcessorMask((UCHAR)node, &mask))
+			continue;
+		for (int cpu = 0; cpu < 64 && cpu < POOL_MAX_CPUS; cpu++) {
+			if ((mask & process) & (1ull << cpu)) {
+				pool_cpus[pool_cpus_len] = cpu;
+				pool_cpu_node[pool_cpus_len++] = pool_nodes;
+			}
+		}
+		pool_nodes++;
+	}
+#else
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	// NOTE (Brian) sysfs lists every node's cpus as ranges like 0-15,32-47
+	for (int node = 0; pool_cpus_len < POOL_MAX_CPUS; node++) {
+		char path[128];
+		snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL)
+			break;
+
+		int lo, hi, found = 0;
+		char sep;
+		while (fscanf(fp, "%d", &lo) == 1) {
+			hi = lo;
+			if (fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+				if (fscanf(fp, "%d", &hi) != 1)
+					break;
+				if (fscanf(fp, "%c", &sep) != 1)
+					sep = '\n';
+			}
+			for (int cpu = lo; cpu <= hi && pool_cpus_len < POOL_MAX_CPUS; cpu++) {
+				if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+					pool_cpus[pool_cpus_len] = cpu;
+					pool_cpu_node[pool_cpus_len++] = pool_nodes;
+					found++;
+				}
+			}
+			if (sep != ',')
+				break;
+		}
+		fclose(fp);
+
+		if (found > 0)
+			pool_nodes++;
+	}
+#endif
+
+	// no numa information, everything is one node
+	if (pool_cpus_len == 0) {
+		int count = PoolCPUCount();
+		for (int cpu = 0; cpu < count && cpu < POOL_MAX_CPUS; cpu++) {
+			pool_cpus[pool_cpus_len] = cpu;
+			pool_cpu_node[pool_cpus_len++] = 0;
+		}
+		pool_nodes = 1;
+	}
+}
+
+// PoolNode: the node a worker runs on, 0 when nothing is pinned
+int PoolNode(int worker)
+{
+	if (G_Pin == PIN_NONE || pool_size == 0)
+		return 0;
+
+	PoolTopology();
+
+	if (G_Pin == PIN_NODE)
+		return (int)((long long)worker * pool_nodes / pool_size);
+
+	return pool_cpu_node[worker % pool_cpus_len];
+}
+
+// PoolNodes: how many nodes the workers are spread over
+int PoolNodes()
+{
+	PoolTopology();
+	return G_Pin == PIN_NONE ? 1 : pool_nodes;
+}
+
+// PoolPin: pins the calling thread to wherever worker is supposed to run
+static void PoolPin(int worker)
+{
+	if (G_Pin == PIN_NONE)
+		return;
+
+	PoolTopology();
+
+	int node = PoolNode(worker);
+
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int i = 0; i < pool_cpus_len; i++) {
+		if (G_Pin == PIN_CORE ? i == worker % pool_cpus_len : pool_cpu_node[i] == node)
+			mask |= (DWORD_PTR)1 << pool_cpus[i];
+	}
+	SetThreadAffinityMask(GetCurrentThread(), mask);
+#else
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (int i = 0; i < pool_cpus_len; i++) {
+		if (G_Pin == PIN_CORE ? i == worker % pool_cpus_len : pool_cpu_node[i] == node)
+			CPU_SET(pool_cpus[i], &mask);
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#endif
+}
+
+static void PoolWorker(int worker)
+{
+	int generation = pool_start_generation;
+
+	PoolPin(worker);
+
+	for (;;) {
+		PoolAwait(&pool_generation, generation, &pool_parked);
+		generation = atomic_load(&pool_generation);
+
+		if (pool_stop)
+			break;
+
+		pool_func(pool_arg, worker, pool_size);
+
+		BarrierWait(&pool_barrier, worker);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI PoolThreadProc(LPVOID param)
+{
+	PoolWorker((int)(intptr_t)param);
+	return 0;
+}
+#else
+static void *PoolThreadProc(void *param)
+{
+	PoolWorker((int)(intptr_t)param);
+	return NULL;
+}
+#endif
+
+// PoolCPUCount: how many threads the machine can run at once
+int PoolCPUCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+// PoolSize: how many workers PoolRun runs on, counting the caller
+int PoolSize()
+{
+	return pool_size;
+}
+
+// PoolStart: starts threads - 1 workers, the caller of PoolRun is the last one
+void PoolStart(int threads)
+{
+	assert(pool_size == 0 && threads > 0);
+
+	pool_size = threads;
+	pool_stop = false;
+	pool_start_generation = atomic_load(&pool_generation);
+
+	BarrierInit(&pool_barrier, threads, G_Barrier);
+
+	pool_threads = calloc(threads, sizeof(*pool_threads));
+	assert(pool_threads != NULL);
+
+	if (G_Pin != PIN_NONE) {
+#ifdef _WIN32
+		pool_caller_mask = SetThreadAffinityMask(GetCurrentThread(), ~(DWORD_PTR)0);
+		SetThreadAffinityMask(GetCurrentThread(), pool_caller_mask);
+#else
+		pthread_getaffinity_np(pthread_self(), sizeof(pool_caller_mask), &pool_caller_mask);
+#endif
+		PoolPin(0);
+	}
+
+	for (int i = 1; i < threads; i++) {
+#ifdef _WIN32
+		pool_threads[i] = CreateThread(NULL, 0, PoolThreadProc, (LPVOID)(intptr_t)i, 0, NULL);
+		assert(pool_threads[i] != NULL);
+#else
+		int rc = pthread_create(pool_threads + i, NULL, PoolThreadProc, (void *)(intptr_t)i);
+		assert(rc == 0);
+#endif
+	}
+}
+
+// PoolRun: runs func(arg, worker, workers) once on every worker, returns when all of them are done
+void PoolRun(PoolFunc func, void *arg)
+{
+	assert(pool_size > 0);
+
+	pool_func = func;
+	pool_arg = arg;
+
+	atomic_fetch_add(&pool_generation, 1);
+	if (atomic_load(&pool_parked) > 0)
+		PoolWake(&pool_generation);
+
+	func(arg, 0, pool_size);
+
+	BarrierWait(&pool_barrier, 0);
+}
+
+// PoolBarrier: called by every worker inside a job, returns once all of them have called it
+void PoolBarrier(int worker)
+{
+	BarrierWait(&pool_barrier, worker);
+}
+
+// PoolStop: tells the workers to quit and waits for them
+void PoolStop()
+{
+	pool_stop = true;
+	atomic_fetch_add(&pool_generation, 1);
+	PoolWake(&pool_generation);
+
+	for (int i = 1; i < pool_size; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(pool_threads[i], INFINITE);
+		CloseHandle(pool_threads[i]);
+#else
+		pthread_join(pool_threads[i], NULL);
+#endif
+	}
+
+	if (G_Pin != PIN_NONE) {
+#ifdef _WIN32
+		SetThreadAffinityMask(GetCurrentThread(), pool_caller_mask);
+#else
+		pthread_setaffinity_np(pthread_self(), sizeof(pool_caller_mask), &pool_caller_mask);
+#endif
+	}
+
+	free(pool_threads);
+	pool_threads = NULL;
+	pool_size = 0;
+
+	BarrierFree(&pool_barrier);
+}
+
+typedef struct {
+	unsigned char *buf;
+	size_t len;
+} PoolTouchJob;
+
+static void PoolTouch(void *arg, int worker, int workers)
+{
+	PoolTouchJob *touch = arg;
+
+	size_t lo = touch->len * worker / workers;
+	size_t hi = touch->len * (worker + 1) / workers;
+	memset(touch->buf + lo, 0, hi - lo);
+}
+
+// PoolFirstTouch: zeroes buf with every worker writing the same share of it a band of rows would
+// get, so on a NUMA machine each share lands in the memory next to the worker that will use it.
+// Only does any good on memory nobody has written to yet.
+void PoolFirstTouch(void *buf, size_t len)
+{
+	PoolTouchJob touch = { buf, len };
+	PoolRun(PoolTouch, &touch);
+}
+
+typedef struct {
+	void (*func)(void *arg);
+	void *arg;
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+} Thread;
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadProc(LPVOID param)
+{
+	Thread *thread = param;
+	thread->func(thread->arg);
+	return 0;
+}
+#else
+static void *ThreadProc(void *param)
+{
+	Thread *thread = param;
+	thread->func(thread->arg);
+	return NULL;
+}
+#endif
+
+// ThreadStart: runs func(arg) on a thread of its own, outside the pool
+void *ThreadStart(void (*func)(void *arg), void *arg)
+{
+	Thread *thread = calloc(1, sizeof(*thread));
+	assert(thread != NULL);
+
+	thread->func = func;
+	thread->arg = arg;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, ThreadProc, thread, 0, NULL);
+	assert(thread->handle != NULL);
+#else
+	int rc = pthread_create(&thread->handle, NULL, ThreadProc, thread);
+	assert(rc == 0);
+#endif
+
+	return thread;
+}
+
+// ThreadJoin: waits for a thread from ThreadStart to return
+void ThreadJoin(void *param)
+{
+	Thread *thread = param;
+
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+
+	free(thread);
+}
+
+// QueueInit: a queue that holds up to cap items, for one thread pushing and one thread popping
+void QueueInit(Queue *queue, int cap)
+{
+	queue->items = calloc(cap, sizeof(*queue->items));
+	assert(queue->items != NULL);
+	queue->cap = cap;
+	atomic_store(&queue->head, 0);
+	atomic_store(&queue->tail, 0);
+	atomic_store(&queue->sleepers, 0);
+}
+
+void QueueFree(Queue *queue)
+{
+	free(queue->items);
+	queue->items = NULL;
+}
+
+// QueuePush: adds item to the back, waits while the queue is full
+void QueuePush(Queue *queue, void *item)
+{
+	int tail = atomic_load(&queue->tail);
+	int head;
+
+	while (tail - (head = atomic_load(&queue->head)) == queue->cap)
+		PoolAwait(&queue->head, head, &queue->sleepers);
+
+	queue->items[tail % queue->cap] = item;
+	atomic_store(&queue->tail, tail + 1);
+
+	if (atomic_load(&queue->sleepers) > 0)
+		PoolWake(&queue->tail);
+}
+
+// QueuePop: takes the item from the front, waits while the queue is empty
+void *QueuePop(Queue *queue)
+{
+	int head = atomic_load(&queue->head);
+	int tail;
+
+	while ((tail = atomic_load(&queue->tail)) == head)
+		PoolAwait(&queue->tail, tail, &queue->sleepers);
+
+	void *item = queue->items[head % queue->cap];
+	atomic_store(&queue->head, head + 1);
+
+	if (atomic_load(&queue->sleepers) > 0)
+		PoolWake(&queue->head);
+
+	return item;
+}
+
+static void PoolEmpty(void *arg, int worker, int workers)
+{
+}
+
+// PoolStraggle: everybody but the caller takes a couple of milliseconds
+static void PoolStraggle(void *arg, int worker, int workers)
+{
+	if (worker == 0)
+		return;
+
+#ifdef _WIN32
+	Sleep(2);
+#else
+	struct timespec ts = { 0, 2000000 };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+// BenchPool: how long a dispatch and join takes, and what the caller burns while it waits
+void BenchPool(int threads)
+{
+	const int rounds = 20000;
+	const int slow_rounds = 100;
+
+	PoolStart(threads);
+
+	// warm up, so every worker has run at least once
+	for (int i = 0; i < 100; i++)
+		PoolRun(PoolEmpty, NULL);
+
+	atomic_store(&pool_spun, 0);
+	atomic_store(&pool_parks, 0);
+
+	double start = GetTime();
+	for (int i = 0; i < rounds; i++)
+		PoolRun(PoolEmpty, NULL);
+	double hot = (GetTime() - start) / rounds;
+
+	long long spun = atomic_exchange(&pool_spun, 0);
+	long long parks = atomic_exchange(&pool_parks, 0);
+
+	printf("%d threads\n", threads);
+	printf("  Back to Back  %8.2fus per dispatch and join, %lld waits spun, %lld parked\n",
+		hot * 1e6, spun, parks);
+
+	// the workers have all gone to sleep by now, so this is the cost of waking them up
+	double cold = 0;
+	for (int i = 0; i < 20; i++) {
+#ifdef _WIN32
+		Sleep(5);
+#else
+		struct timespec ts = { 0, 5000000 };
+		nanosleep(&ts, NULL);
+#endif
+		start = GetTime();
+		PoolRun(PoolEmpty, NULL);
+		cold += GetTime() - start;
+	}
+
+	printf("  From Asleep   %8.2fus per dispatch and join\n", cold / 20 * 1e6);
+
+	// NOTE (Brian) clock() is process cpu time everywhere but Windows, where it's wall time
+#ifndef _WIN32
+	if (threads == 1) {
+		PoolStop();
+		return;
+	}
+
+	clock_t cpu = clock();
+	start = GetTime();
+	for (int i = 0; i < slow_rounds; i++)
+		PoolRun(PoolStraggle, NULL);
+	double wall = GetTime() - start;
+	double used = (double)(clock() - cpu) / CLOCKS_PER_SEC;
+
+	printf("  Stragglers    %8.2fms waiting on 2ms workers, %.2fms of cpu used (%.1f%% of one core)\n",
+		wall * 1000, used * 1000, 100.0 * used / wall);
+#endif
+
+	PoolStop();
+}
@@ -0,0 +1,163 @@
+// Brian Chrzanowski
+// Quadtree Voronoi Engine
+//
+// Most of a frame is big areas of one color. The frame is covered with QUAD_ROOT sized blocks, and
+// for each block we look at its four corners. d_j^2 - d_o^2 is linear in the pixel position for any
+// two points o and j, so if o beats everything by a safe margin at all four corners, it beats them
+// everywhere in between, and the whole block gets o's label. Otherwise the block is cut
+// into four and each quarter is tried again, down to single pixels, which are picked with
+// UpdatePixelForPoints.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+#define QUAD_ROOT 64
+
+static Label *quad_labels;
+static Point *quad_points;
+static int quad_points_len;
+
+// float distances can be off by a few ulps of the largest squared distance in the frame, a margin
+// bigger than this can't be undone by rounding in UpdatePixelForPoints
+static double quad_margin;
+
+typedef struct {
+	long long filled;
+	long long filled_pixels;
+	long long split;
+	long long single;
+} QuadCounts;
+
+static atomic_llong quad_filled;
+static atomic_llong quad_filled_pixels;
+static atomic_llong quad_split;
+static atomic_llong quad_single;
+
+static int QuadBegin(Label *labels, Point *points, int points_len)
+{
+	quad_labels = labels;
+	quad_points = points;
+	quad_points_len = points_len;
+
+	float lox = 0, hix = G_WIDTH - 1, loy = 0, hiy = G_HEIGHT - 1;
+	for (int i = 0; i < points_len; i++) {
+		lox = fminf(lox, points[i].px);
+		hix = fmaxf(hix, points[i].px);
+		loy = fminf(loy, points[i].py);
+		hiy = fmaxf(hiy, points[i].py);
+	}
+
+	quad_margin = ldexp((double)(hix - lox) * (hix - lox) + (double)(hiy - loy) * (hiy - loy), -20);
+
+	return 1;
+}
+
+// QuadOwner: the point that owns the whole block, or -1 if the corners can't prove there is one
+static int QuadOwner(int x0, int y0, int x1, int y1)
+{
+	double xs[2] = { x0, x1 - 1 };
+	double ys[2] = { y0, y1 - 1 };
+	int owner = -1;
+
+	for (int c = 0; c < 4; c++) {
+		double x = xs[c & 1], y = ys[c >> 1];
+		double best = DBL_MAX, second = DBL_MAX;
+		int picked = -1;
+
+		for (int i = 0; i < quad_points_len; i++) {
+			double xd = quad_points[i].px - x;
+			double yd = quad_points[i].py - y;
+			double d = xd * xd + yd * yd;
+			if (d < best) {
+				second = best;
+				best = d;
+				picked = i;
+			} else if (d < second) {
+				second = d;
+			}
+		}
+
+		if (owner >= 0 && picked != owner)
+			return -1;
+		if (second - best < quad_margin)
+			return -1;
+
+		owner = picked;
+	}
+
+	return owner;
+}
+
+static void QuadBlock(int x0, int y0, int x1, int y1, QuadCounts *counts)
+{
+	if (x1 - x0 == 1 && y1 - y0 == 1) {
+		UpdatePixelForPoints(quad_labels + (x0 + G_WIDTH * y0), x0, y0, quad_points, quad_points_len);
+		counts->single++;
+		return;
+	}
+
+	int owner = QuadOwner(x0, y0, x1, y1);
+
+	if (owner >= 0) {
+		for (int y = y0; y < y1; y++)
+			FillLabels(quad_labels + (x0 + G_WIDTH * y), (Label)owner, x1 - x0);
+		counts->filled++;
+		counts->filled_pixels += (long long)(x1 - x0) * (y1 - y0);
+		return;
+	}
+
+	counts->split++;
+
+	int mx = x0 + (x1 - x0 + 1) / 2;
+	int my = y0 + (y1 - y0 + 1) / 2;
+
+	QuadBlock(x0, y0, mx, my, counts);
+	if (mx < x1)
+		QuadBlock(mx, y0, x1, my, counts);
+	if (my < y1)
+		QuadBlock(x0, my, mx, y1, counts);
+	if (mx < x1 && my < y1)
+		QuadBlock(mx, my, x1, y1, counts);
+}
+
+static void QuadPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	QuadCounts counts = { 0 };
+
+	for (int by = y0; by < y1; by += QUAD_ROOT) {
+		for (int bx = x0; bx < x1; bx += QUAD_ROOT) {
+			int hix = bx + QUAD_ROOT > x1 ? x1 : bx + QUAD_ROOT;
+			int hiy = by + QUAD_ROOT > y1 ? y1 : by + QUAD_ROOT;
+			QuadBlock(bx, by, hix, hiy, &counts);
+		}
+	}
+
+	atomic_fetch_add(&quad_filled, counts.filled);
+	atomic_fetch_add(&quad_filled_pixels, counts.filled_pixels);
+	atomic_fetch_add(&quad_split, counts.split);
+	atomic_fetch_add(&quad_single, counts.single);
+}
+
+static void QuadReport()
+{
+	long long filled = atomic_exchange(&quad_filled, 0);
+	long long filled_pixels = atomic_exchange(&quad_filled_pixels, 0);
+	long long split = atomic_exchange(&quad_split, 0);
+	long long single = atomic_exchange(&quad_single, 0);
+	long long total = filled_pixels + single;
+
+	if (total == 0)
+		return;
+
+	printf("  Blocks        %lld filled, %lld split, %lld single pixels\n", filled, split, single);
+	printf("  Pixels        %.2f%% filled in blocks, %.2f%% picked one at a time\n",
+		100.0 * filled_pixels / total, 100.0 * single / total);
+}
+
+Engine QuadtreeEngine = { "quadtree", QuadBegin, QuadPhase, QuadReport };
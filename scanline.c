@@ -0,0 +1,462 @@
+// Brian Chrzanowski
+// Scanline Voronoi Engine
+//
+// Along a single row the squared distance to a point is (x - px)^2 + dy^2, and because every point
+// shares the x^2 term, which point is closest only depends on the lines -2 px x + px^2 + dy^2. The
+// closest point along the row is the lower envelope of those lines, so instead of testing every
+// point at every pixel we build the envelope once per row and fill whole runs of pixels.
+//
+// Only points near the row can be on its envelope inside the frame, so each row's envelope is built
+// from the points of a band of grid cells around it, which is about as many as the cells the row
+// crosses. If the band turns out narrower than the furthest any pixel of the row is from its owner,
+// it's doubled and the row built again.
+//
+// The envelope is built in doubles, but UpdatePixelForPoints picks in floats. To stay pixel
+// identical, pixels where some other point is within float rounding error of the owner are picked
+// again exactly the way UpdatePixelForPoints does it, against just the points in the cells around
+// the run.
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+typedef struct {
+	double m, c; // line is m * x + c
+	int idx;
+} Line;
+
+typedef struct {
+	Line *hull; // the lower envelope of the row, left to right
+	int hull_len, hull_cap;
+} ScanRowHull;
+
+// the most points that can be close to an owner before we give up and pick against all of them
+#define SCAN_CANDIDATES 64
+
+static Label *scan_labels;
+static Point *scan_points;
+static int scan_points_len;
+
+static int *scan_scratch; // scan_scratch_cap point indices per worker
+static int scan_scratch_workers, scan_scratch_cap;
+
+static ScanRowHull *scan_rows; // G_HEIGHT of them, kept between frames so they only ever grow
+static int scan_rows_len;
+
+// points bucketed into square cells, each cell sorted by px
+static int *scan_cell_start;
+static int *scan_cell_points;
+static int scan_cells_cap;
+static int scan_cols, scan_cells_rows;
+static float scan_cell_size, scan_lox, scan_loy;
+
+static double scan_tolerance;
+
+static int ScanCompare(const void *a, const void *b)
+{
+	Point *pa = scan_points + *(const int *)a;
+	Point *pb = scan_points + *(const int *)b;
+
+	if (pa->px != pb->px)
+		return pa->px < pb->px ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+// ScanCell: the cell coordinate of v along an axis starting at lo, clamped to [0, len)
+static int ScanCell(double v, float lo, int len)
+{
+	double c = floor((v - lo) / scan_cell_size);
+	if (c < 0)
+		return 0;
+	if (c >= len)
+		return len - 1;
+	return (int)c;
+}
+
+static int ScanBegin(Label *labels, Point *points, int points_len)
+{
+	scan_labels = labels;
+	scan_points = points;
+	scan_points_len = points_len;
+
+	// NOTE (Brian) a frame drawn on the calling thread is worker 0, so there's always at least one
+	int workers = PoolSize() > 0 ? PoolSize() : 1;
+	if (scan_scratch_workers < workers || scan_scratch_cap < points_len) {
+		free(scan_scratch);
+		free(scan_cell_points);
+		scan_scratch = malloc((size_t)workers * points_len * sizeof(*scan_scratch));
+		scan_cell_points = malloc(points_len * sizeof(*scan_cell_points));
+		assert(scan_scratch != NULL && scan_cell_points != NULL);
+		scan_scratch_workers = workers;
+		scan_scratch_cap = points_len;
+	}
+
+	if (scan_rows_len != G_HEIGHT) {
+		for (int y = 0; y < scan_rows_len; y++)
+			free(scan_rows[y].hull);
+		free(scan_rows);
+		scan_rows = calloc(G_HEIGHT, sizeof(*scan_rows));
+		assert(scan_rows != NULL);
+		scan_rows_len = G_HEIGHT;
+	}
+
+	// NOTE (Brian) a float squared distance is within about 4 ulps of the real one, so two points
+	// whose real distances differ by more than this can't get swapped by rounding. Dmax is the
+	// biggest squared distance any point can have from any pixel.
+	float lox = 0, hix = G_WIDTH - 1, loy = 0, hiy = G_HEIGHT - 1;
+	for (int i = 0; i < points_len; i++) {
+		lox = fminf(lox, points[i].px);
+		hix = fmaxf(hix, points[i].px);
+		loy = fminf(loy, points[i].py);
+		hiy = fmaxf(hiy, points[i].py);
+	}
+
+	double dmax = (double)(hix - lox) * (hix - lox) + (double)(hiy - loy) * (hiy - loy);
+	scan_tolerance = ldexp(dmax, -20);
+
+	// about one point per cell
+	scan_cell_size = fmaxf(sqrtf((hix - lox + 1) * (hiy - loy + 1) / fmaxf(points_len, 1)), 1);
+	scan_lox = lox;
+	scan_loy = loy;
+	scan_cols = (int)((hix - lox) / scan_cell_size) + 1;
+	scan_cells_rows = (int)((hiy - loy) / scan_cell_size) + 1;
+
+	int cells = scan_cols * scan_cells_rows;
+	if (scan_cells_cap < cells) {
+		free(scan_cell_start);
+		scan_cell_start = malloc((cells + 1) * sizeof(*scan_cell_start));
+		assert(scan_cell_start != NULL);
+		scan_cells_cap = cells;
+	}
+
+	memset(scan_cell_start, 0, (cells + 1) * sizeof(*scan_cell_start));
+	for (int i = 0; i < points_len; i++) {
+		int c = ScanCell(points[i].py, loy, scan_cells_rows) * scan_cols + ScanCell(points[i].px, lox, scan_cols);
+		scan_cell_start[c + 1]++;
+	}
+	for (int c = 0; c < cells; c++)
+		scan_cell_start[c + 1] += scan_cell_start[c];
+	for (int i = 0; i < points_len; i++) {
+		int c = ScanCell(points[i].py, loy, scan_cells_rows) * scan_cols + ScanCell(points[i].px, lox, scan_cols);
+		scan_cell_points[scan_cell_start[c]++] = i;
+	}
+	for (int c = cells; c > 0; c--)
+		scan_cell_start[c] = scan_cell_start[c - 1];
+	scan_cell_start[0] = 0;
+
+	for (int c = 0; c < cells; c++) {
+		int len = scan_cell_start[c + 1] - scan_cell_start[c];
+		if (len > 1)
+			qsort(scan_cell_points + scan_cell_start[c], len, sizeof(*scan_cell_points), ScanCompare);
+	}
+
+	return 2;
+}
+
+// ScanExact: picks between candidates exactly the way UpdatePixelForPoints would, or between every
+// point when candidates is NULL
+static void ScanExact(Label *row, int xa, int xb, int y, int *candidates, int candidates_len)
+{
+	if (candidates == NULL)
+		candidates_len = scan_points_len;
+
+	for (int x = xa; x < xb; x++) {
+		float x1 = x, y1 = y;
+		float min = FLT_MAX;
+		int picked = -1;
+
+		// candidates are in index order, so ties go to the lower index like they do in brute force
+		for (int i = 0; i < candidates_len; i++) {
+			int idx = candidates != NULL ? candidates[i] : i;
+			Point *p = scan_points + idx;
+			float xd = p->px - x1;
+			float yd = p->py - y1;
+			float currdist = xd * xd + yd * yd;
+			if (currdist < min) {
+				min = currdist;
+				picked = idx;
+			}
+		}
+
+		assert(picked >= 0);
+		row[x] = (Label)picked;
+	}
+}
+
+static int IntCompare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+// ScanLine: the line of point idx along row y
+static Line ScanLine(int idx, int y)
+{
+	Point *p = scan_points + idx;
+	double px = p->px;
+	double dy = (double)p->py - y;
+	return (Line){ -2.0 * px, px * px + dy * dy, idx };
+}
+
+// ScanHullOf: builds the lower envelope of row y out of the points in band, sorted by px
+static void ScanHullOf(ScanRowHull *r, int *band, int band_len, int y)
+{
+	Line *hull = r->hull;
+	int hull_len = 0;
+
+	// slopes only ever go down, so this is the usual convex hull trick
+	for (int i = 0; i < band_len; i++) {
+		Line l = ScanLine(band[i], y);
+
+		if (hull_len > 0 && hull[hull_len - 1].m == l.m) {
+			if (hull[hull_len - 1].c <= l.c)
+				continue;
+			hull_len--;
+		}
+
+		while (hull_len >= 2) {
+			Line *a = hull + hull_len - 2;
+			Line *b = hull + hull_len - 1;
+			// b is never the lowest if a and l cross before a and b do
+			if ((l.c - a->c) * (a->m - b->m) <= (b->c - a->c) * (a->m - l.m))
+				hull_len--;
+			else
+				break;
+		}
+
+		if (hull_len == r->hull_cap) {
+			r->hull_cap = r->hull_cap ? r->hull_cap * 2 : 64;
+			hull = r->hull = realloc(r->hull, r->hull_cap * sizeof(*hull));
+			assert(hull != NULL);
+		}
+
+		hull[hull_len++] = l;
+	}
+
+	r->hull_len = hull_len;
+}
+
+static double ScanBreak(Line *hull, int h);
+
+// ScanHullReach: the furthest any pixel of the row is from its owner on the envelope, which along
+// one owner's run is always at one of the ends
+static double ScanHullReach(ScanRowHull *r)
+{
+	double worst = -1;
+
+	for (int h = 0; h < r->hull_len; h++) {
+		double lo = h > 0 ? ScanBreak(r->hull, h - 1) : 0;
+		double hi = h + 1 < r->hull_len ? ScanBreak(r->hull, h) : G_WIDTH - 1;
+		lo = fmax(lo, 0);
+		hi = fmin(hi, G_WIDTH - 1);
+		if (lo > hi)
+			continue;
+
+		Line *o = r->hull + h;
+		worst = fmax(worst, o->m * lo + o->c + lo * lo);
+		worst = fmax(worst, o->m * hi + o->c + hi * hi);
+	}
+
+	return worst < 0 ? DBL_MAX : sqrt(worst);
+}
+
+// ScanHull: builds the lower envelope of row y from the points near it
+static void ScanHull(int worker, int y)
+{
+	ScanRowHull *r = scan_rows + y;
+	int *band = scan_scratch + (size_t)worker * scan_scratch_cap;
+	double reach = 2 * scan_cell_size;
+
+	for (;;) {
+		int cy0 = ScanCell(y - reach, scan_loy, scan_cells_rows);
+		int cy1 = ScanCell(y + reach, scan_loy, scan_cells_rows);
+		bool all = cy0 == 0 && cy1 == scan_cells_rows - 1 && reach > scan_cells_rows * scan_cell_size;
+		int band_len = 0;
+
+		// columns of cells are in px order already, so only the few cells of a column need merging
+		for (int cx = 0; cx < scan_cols; cx++) {
+			int start = band_len;
+
+			for (int cy = cy0; cy <= cy1; cy++) {
+				int c = cy * scan_cols + cx;
+				for (int k = scan_cell_start[c]; k < scan_cell_start[c + 1]; k++) {
+					int idx = scan_cell_points[k];
+					if (fabs((double)scan_points[idx].py - y) > reach)
+						continue;
+
+					int at = band_len++;
+					while (at > start && ScanCompare(band + at - 1, &idx) > 0) {
+						band[at] = band[at - 1];
+						at--;
+					}
+					band[at] = idx;
+				}
+			}
+		}
+
+		ScanHullOf(r, band, band_len, y);
+
+		// NOTE (Brian) a point outside the band is further than reach from every pixel of the row, so
+		// if every pixel has its owner closer than that, nothing outside could have been on the envelope
+		if (all || ScanHullReach(r) + 1 <= reach)
+			return;
+
+		reach *= 2;
+	}
+}
+
+// ScanHullColumn: which column's tile builds the envelope of row y, spread out over the row so every
+// tile in a band of rows gets a share of the rows
+static int ScanHullColumn(int y)
+{
+	return (int)(((uint32_t)y * 2654435761u) % (uint32_t)G_WIDTH);
+}
+
+// ScanBreak: where hull line h hands the row over to h + 1
+static double ScanBreak(Line *hull, int h)
+{
+	return (hull[h + 1].c - hull[h].c) / (hull[h].m - hull[h + 1].m);
+}
+
+// ScanRow: fills [x0, x1) of row y from its envelope
+static void ScanRow(int y, int x0, int x1)
+{
+	Label *row = scan_labels + G_WIDTH * y;
+	Line *hull = scan_rows[y].hull;
+	int hull_len = scan_rows[y].hull_len;
+
+	// the first line still lowest at x0, breakpoints only ever go up
+	int lo = 0, hi = hull_len - 1;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (ScanBreak(hull, mid) < x0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	int xa = x0;
+
+	for (int h = lo; h < hull_len && xa < x1; h++) {
+		Line *o = hull + h;
+		int xb = x1 - 1;
+
+		if (h + 1 < hull_len) {
+			double bp = ScanBreak(hull, h);
+			if (bp < xa)
+				continue;
+			if (bp < xb)
+				xb = (int)floor(bp);
+		}
+
+		// [xa, xb] belongs to o, except where something else comes within the tolerance, and
+		// because the gap to any other point is linear in x it's enough to look at the ends
+		int candidates[SCAN_CANDIDATES];
+		int candidates_len = 0;
+		int p = xa, s = xb + 1;
+
+		candidates[candidates_len++] = o->idx;
+
+		// NOTE (Brian) anything within the tolerance at an end is within sqrt(d + tolerance) of that
+		// pixel, d being the owner's squared distance there, so only the cells around the run can have it
+		double da = o->m * xa + o->c + (double)xa * xa;
+		double db = o->m * xb + o->c + (double)xb * xb;
+		double reach = sqrt(fmax(da, db) + scan_tolerance) + 1;
+
+		int cx0 = ScanCell(xa - reach, scan_lox, scan_cols);
+		int cx1 = ScanCell(xb + reach, scan_lox, scan_cols);
+		int cy0 = ScanCell(y - reach, scan_loy, scan_cells_rows);
+		int cy1 = ScanCell(y + reach, scan_loy, scan_cells_rows);
+
+		for (int cy = cy0; cy <= cy1 && candidates_len <= SCAN_CANDIDATES; cy++) {
+			for (int cx = cx0; cx <= cx1 && candidates_len <= SCAN_CANDIDATES; cx++) {
+				int c = cy * scan_cols + cx;
+
+				for (int k = scan_cell_start[c]; k < scan_cell_start[c + 1]; k++) {
+					if (scan_cell_points[k] == o->idx)
+						continue;
+
+					Line l = ScanLine(scan_cell_points[k], y);
+					double b = l.m - o->m;
+					double a = l.c - o->c;
+
+					if (a + b * xa >= scan_tolerance && a + b * xb >= scan_tolerance)
+						continue;
+
+					if (candidates_len == SCAN_CANDIDATES) {
+						candidates_len++;
+						break;
+					}
+
+					candidates[candidates_len++] = l.idx;
+
+					double r = (scan_tolerance - a) / b;
+					if (b == 0 || isnan(r)) {
+						p = xb + 1;
+					} else if (b > 0) {
+						// close for x < r, at the start of the run
+						if (r > xb + 1)
+							p = xb + 1;
+						else if (p < (int)ceil(r) + 1)
+							p = (int)ceil(r) + 1;
+					} else {
+						// close for x > r, at the end of the run
+						if (r < xa)
+							s = xa;
+						else if (s > (int)floor(r))
+							s = (int)floor(r);
+					}
+				}
+			}
+		}
+
+		if (candidates_len > SCAN_CANDIDATES) {
+			// too many near ties to keep track of, so pick the whole run against everything
+			ScanExact(row, xa, xb + 1, y, NULL, 0);
+			xa = xb + 1;
+			continue;
+		}
+
+		if (p > xb + 1)
+			p = xb + 1;
+		if (s < xa)
+			s = xa;
+
+		if (candidates_len > 1)
+			qsort(candidates, candidates_len, sizeof(*candidates), IntCompare);
+
+		if (p >= s) {
+			ScanExact(row, xa, xb + 1, y, candidates, candidates_len);
+		} else {
+			ScanExact(row, xa, p, y, candidates, candidates_len);
+			FillLabels(row + p, (Label)o->idx, s - p);
+			ScanExact(row, s, xb + 1, y, candidates, candidates_len);
+		}
+
+		xa = xb + 1;
+	}
+
+	assert(xa >= x1);
+}
+
+// ScanPhase: phase 0 builds the envelope of every row once, by the tile that has the row's
+// ScanHullColumn, and phase 1 fills the tiles from them
+static void ScanPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	if (phase == 0) {
+		for (int y = y0; y < y1; y++) {
+			int x = ScanHullColumn(y);
+			if (x0 <= x && x < x1)
+				ScanHull(worker, y);
+		}
+		return;
+	}
+
+	for (int y = y0; y < y1; y++)
+		ScanRow(y, x0, x1);
+}
+
+Engine ScanlineEngine = { "scanline", ScanBegin, ScanPhase };
@@ -0,0 +1,303 @@
+// Brian Chrzanowski
+// Work Stealing Tile Scheduler
+//
+// A phase is cut into G_TileSize x G_TileSize tiles (the ones on the right and bottom edges are
+// whatever is left over, so any resolution is covered). Every worker starts with a contiguous run
+// of tiles in its own deque and takes them from the front, which keeps neighbouring tiles on the
+// same thread. A worker that runs out steals from the back of somebody else's deque, so a thread
+// that drew the expensive part of the frame doesn't hold everyone else up.
+//
+// When the pool is pinned, thieves go through the workers on their own node before anyone else's,
+// so most stolen tiles are still in local memory.
+//
+// All the phases of a frame go out in one PoolRun, with a PoolBarrier between them. Every worker
+// has two deques and the phases alternate between them, so while phase p is still being stolen from,
+// each worker refills its own other deque for phase p + 1, which nobody has touched since the barrier
+// in front of p.
+//
+// NOTE (Brian) the deques are filled before anyone takes from them and only ever shrink, so each one
+// is just a [front, back) pair in one 64 bit word, and both ends are taken with a compare and swap.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+int G_TileSize = 64;
+
+typedef struct {
+	_Alignas(64) atomic_ullong range[2]; // front in the low 32 bits, back in the high 32 bits, by phase parity
+	long long tiles;
+	long long steals;
+	long long remote_steals;
+	double busy;
+} SchedWorker;
+
+typedef struct {
+	TileFunc func;
+	void *arg;
+	int phases;
+	int across;
+	int tiles;
+} SchedJob;
+
+static SchedWorker *sched_workers; // cache line aligned, inside sched_alloc
+static void *sched_alloc;
+static int sched_workers_len;
+static bool sched_steal = true;
+
+static long long sched_phases;
+static double sched_time;
+
+#define SCHED_RANGE(front, back) ((unsigned long long)(back) << 32 | (unsigned)(front))
+#define SCHED_FRONT(range) ((int)((range) & 0xffffffff))
+#define SCHED_BACK(range) ((int)((range) >> 32))
+
+// SchedTake: takes a tile from the front (the owner) or the back (a thief), -1 if it's empty
+static int SchedTake(atomic_ullong *deque, bool back)
+{
+	unsigned long long range = atomic_load(deque);
+
+	for (;;) {
+		int front = SCHED_FRONT(range), end = SCHED_BACK(range);
+		if (front >= end)
+			return -1;
+
+		unsigned long long next = back ? SCHED_RANGE(front, end - 1) : SCHED_RANGE(front + 1, end);
+		if (atomic_compare_exchange_weak(deque, &range, next))
+			return back ? end - 1 : front;
+	}
+}
+
+static void SchedRunTile(SchedJob *job, int worker, int phase, int tile)
+{
+	int x0 = (tile % job->across) * G_TileSize;
+	int y0 = (tile / job->across) * G_TileSize;
+	int x1 = x0 + G_TileSize < G_WIDTH ? x0 + G_TileSize : G_WIDTH;
+	int y1 = y0 + G_TileSize < G_HEIGHT ? y0 + G_TileSize : G_HEIGHT;
+
+	SchedWorker *self = sched_workers + worker;
+
+	double start = GetTime();
+	job->func(job->arg, worker, phase, x0, y0, x1, y1);
+	self->busy += GetTime() - start;
+	self->tiles++;
+}
+
+// SchedFill: worker's own share of the tiles
+static unsigned long long SchedFill(SchedJob *job, int worker, int workers)
+{
+	int front = (int)((long long)job->tiles * worker / workers);
+	int back = (int)((long long)job->tiles * (worker + 1) / workers);
+	return SCHED_RANGE(front, back);
+}
+
+// SchedPhase: runs our own tiles of phase, then steals until there's nothing left anywhere
+static void SchedPhase(SchedJob *job, int phase, int worker, int workers)
+{
+	SchedWorker *self = sched_workers + worker;
+	int parity = phase & 1;
+	int tile;
+
+	while ((tile = SchedTake(&self->range[parity], false)) >= 0)
+		SchedRunTile(job, worker, phase, tile);
+
+	if (!sched_steal)
+		return;
+
+	// NOTE (Brian) a deque that's been seen empty stays empty for the rest of the phase, so one lap
+	// around everybody is enough, the first one only on our own node and the second one everywhere else
+	int node = PoolNode(worker);
+
+	for (int remote = 0; remote <= 1; remote++) {
+		for (int i = 1; i < workers; i++) {
+			int victim = (worker + i) % workers;
+			if ((PoolNode(victim) != node) != remote)
+				continue;
+
+			while ((tile = SchedTake(&sched_workers[victim].range[parity], true)) >= 0) {
+				self->steals++;
+				self->remote_steals += remote;
+				SchedRunTile(job, worker, phase, tile);
+			}
+		}
+	}
+}
+
+static void SchedWork(void *arg, int worker, int workers)
+{
+	SchedJob *job = arg;
+
+	for (int phase = 0; phase < job->phases; phase++) {
+		if (phase > 0)
+			PoolBarrier(worker);
+
+		if (phase + 1 < job->phases)
+			atomic_store(&sched_workers[worker].range[(phase + 1) & 1], SchedFill(job, worker, workers));
+
+		SchedPhase(job, phase, worker, workers);
+	}
+}
+
+// SchedRun: calls func over every tile of phases 0 to phases - 1, each one finished before the next
+// one starts, on the worker pool, which has to be started
+void SchedRun(TileFunc func, void *arg, int phases)
+{
+	int workers = PoolSize();
+
+	if (sched_workers_len != workers) {
+		free(sched_alloc);
+		sched_alloc = calloc(workers + 1, sizeof(*sched_workers));
+		assert(sched_alloc != NULL);
+		sched_workers = (SchedWorker *)(((uintptr_t)sched_alloc + 63) & ~(uintptr_t)63);
+		sched_workers_len = workers;
+	}
+
+	if (phases <= 0)
+		return;
+
+	SchedJob job = { func, arg, phases };
+	job.across = (G_WIDTH + G_TileSize - 1) / G_TileSize;
+	job.tiles = job.across * ((G_HEIGHT + G_TileSize - 1) / G_TileSize);
+
+	for (int i = 0; i < workers; i++)
+		atomic_store(&sched_workers[i].range[0], SchedFill(&job, i, workers));
+
+	double start = GetTime();
+	PoolRun(SchedWork, &job);
+	sched_time += GetTime() - start;
+	sched_phases += phases;
+}
+
+// SchedReset: forgets the counters without printing them
+void SchedReset()
+{
+	sched_phases = 0;
+	sched_time = 0;
+	for (int i = 0; i < sched_workers_len; i++) {
+		sched_workers[i].busy = 0;
+		sched_workers[i].tiles = 0;
+		sched_workers[i].steals = 0;
+		sched_workers[i].remote_steals = 0;
+	}
+}
+
+// SchedReport: prints what every worker did since the last report, and how even it was
+void SchedReport()
+{
+	if (sched_phases == 0)
+		return;
+
+	double busy_sum = 0, busy_max = 0;
+	long long steals = 0;
+
+	printf("  Scheduler     %lld phases, %dx%d tiles, %s\n", sched_phases, G_TileSize, G_TileSize,
+		sched_steal ? "stealing" : "no stealing");
+
+	for (int i = 0; i < sched_workers_len; i++) {
+		SchedWorker *w = sched_workers + i;
+		printf("    worker %-3d  node %-2d  busy %9.3fms  %7lld tiles  %6lld stolen  %6lld from another node\n",
+			i, PoolNode(i), w->busy * 1000, w->tiles, w->steals, w->remote_steals);
+
+		busy_sum += w->busy;
+		if (busy_max < w->busy)
+			busy_max = w->busy;
+		steals += w->steals;
+
+	}
+
+	// balance is how much of the time the workers spent waiting on the busiest one was useful
+	double avg = busy_sum / sched_workers_len;
+	printf("  Balance       %.1f%% (avg busy / max busy), %lld steals, %.3fms per phase\n",
+		busy_max > 0 ? 100.0 * avg / busy_max : 100.0, steals, sched_time * 1000 / sched_phases);
+
+	SchedReset();
+}
+
+static void SchedFrameTile(void *arg, int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	Engine *engine = arg;
+	engine->Phase(worker, phase, x0, y0, x1, y1);
+}
+
+// SchedFrame: every phase of one frame of engine on the pool, without resolving any colors
+void SchedFrame(Engine *engine, Label *labels, Point *points, int points_len)
+{
+	int phases = engine->Begin(labels, points, points_len);
+	SchedRun(SchedFrameTile, engine, phases);
+}
+
+// BenchSched: renders frames with and without stealing, and prints both reports
+void BenchSched(Engine *engine, Point *points, int points_len, int threads)
+{
+	const int frames = 10;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	Label *labels = calloc(total, sizeof(*labels));
+	assert(labels != NULL);
+
+	PoolStart(threads);
+
+	printf("%s, %d points, %dx%d, %d threads, %d frames\n", engine->name, points_len, G_WIDTH, G_HEIGHT, threads, frames);
+
+	for (int steal = 0; steal <= 1; steal++) {
+		sched_steal = steal;
+
+		for (int f = 0; f < frames; f++)
+			SchedFrame(engine, labels, points, points_len);
+
+		SchedReport();
+	}
+
+	sched_steal = true;
+
+	PoolStop();
+	free(labels);
+}
+
+// BenchScaling: frame time for 1, 2, 4, ... threads up to threads, every run with fresh buffers that
+// its own workers touched first
+void BenchScaling(Engine *engine, Point *points, int points_len, int threads)
+{
+	static char *pins[] = { "none", "core", "node" };
+	const int frames = 10;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+	double base = 0;
+
+	printf("%s, %d points, %dx%d, %d frames, pinned to %s, %d nodes\n", engine->name, points_len,
+		G_WIDTH, G_HEIGHT, frames, pins[G_Pin], PoolNodes());
+
+	for (int n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+		Label *labels = malloc(total * sizeof(*labels));
+		assert(labels != NULL);
+
+		PoolStart(n);
+		PoolFirstTouch(labels, total * sizeof(*labels));
+
+		// one frame to warm up whatever the engine keeps between frames
+		SchedFrame(engine, labels, points, points_len);
+
+		double start = GetTime();
+		for (int f = 0; f < frames; f++)
+			SchedFrame(engine, labels, points, points_len);
+		double elapsed = (GetTime() - start) / frames;
+
+		if (n == 1)
+			base = elapsed;
+
+		printf("  %3d threads  %9.3fms  %6.2fx  %5.1f%% efficient\n", n, elapsed * 1000,
+			base / elapsed, 100.0 * base / elapsed / n);
+
+		// the per worker counters aren't what this is about
+		SchedReset();
+
+		PoolStop();
+		free(labels);
+
+		if (n == threads)
+			break;
+	}
+}
@@ -0,0 +1,344 @@
+// Brian Chrzanowski
+// SIMD Voronoi Engine
+//
+// Brute force, but 8 (AVX2) or 16 (AVX-512) pixels of a row at a time. Every lane keeps its own
+// running minimum and the index it came from, and the points are read from a structure of arrays
+// copy made once per frame, so the inner loop only touches the 8 bytes of px/py it needs instead
+// of the whole 32 byte Point.
+//
+// Every lane does the same float math in the same order as UpdatePixelForPoints, so the output is
+// identical to it, as long as the compiler doesn't fuse the multiply and add into an FMA, which rounds
+// once instead of twice. Which kernel runs is decided at runtime from CPUID, with a scalar fallback.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#include "voronoi.h"
+
+// NOTE (Brian) build.sh already passes -ffp-contract=off, this is for whoever builds with gcc -O2 and
+// doesn't, the avx512f target turns on FMA and gcc happily fuses the intrinsics into one
+#if defined(__GNUC__) && !defined(__clang__)
+#define SIMD_NO_FMA __attribute__((optimize("fp-contract=off")))
+#else
+#define SIMD_NO_FMA
+#endif
+
+typedef void (*NearestRowFunc)(Label *row, int x0, int x1, int y);
+
+static Label *simd_labels;
+static int simd_points_len;
+
+// the structure of arrays the kernels read, either G_PointSet's or the copy below
+static float *simd_px;
+static float *simd_py;
+
+static float *simd_copy_px;
+static float *simd_copy_py;
+static int simd_cap;
+
+static NearestRowFunc simd_kernel;
+
+static void NearestRowScalar(Label *row, int x0, int x1, int y)
+{
+	float y1 = y;
+
+	for (int x = x0; x < x1; x++) {
+		float x1 = x;
+		float min = FLT_MAX;
+		int picked = -1;
+
+		for (int i = 0; i < simd_points_len; i++) {
+			float xd = simd_px[i] - x1;
+			float yd = simd_py[i] - y1;
+			float currdist = xd * xd + yd * yd;
+			if (currdist < min) {
+				min = currdist;
+				picked = i;
+			}
+		}
+
+		assert(picked >= 0);
+		row[x] = (Label)picked;
+	}
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("avx2"))) SIMD_NO_FMA
+static void NearestRowAVX2(Label *row, int x0, int x1, int y)
+{
+	const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	float y1 = y;
+
+	for (int x = x0; x < x1; x += 8) {
+		__m256 xs = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+		__m256 min = _mm256_set1_ps(FLT_MAX);
+		__m256i picked = _mm256_setzero_si256();
+
+		for (int i = 0; i < simd_points_len; i++) {
+			float yd = simd_py[i] - y1;
+			__m256 xd = _mm256_sub_ps(_mm256_set1_ps(simd_px[i]), xs);
+			__m256 currdist = _mm256_add_ps(_mm256_mul_ps(xd, xd), _mm256_set1_ps(yd * yd));
+			__m256 closer = _mm256_cmp_ps(currdist, min, _CMP_LT_OQ);
+			min = _mm256_blendv_ps(min, currdist, closer);
+			picked = _mm256_blendv_epi8(picked, _mm256_set1_epi32(i), _mm256_castps_si256(closer));
+		}
+
+		Label tmp[8];
+#ifdef WIDE_LABELS
+		_mm256_storeu_si256((__m256i *)tmp, picked);
+#else
+		// indices fit in 16 bits, so the saturating pack never saturates
+		__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(picked), _mm256_extracti128_si256(picked, 1));
+		_mm_storeu_si128((__m128i *)tmp, packed);
+#endif
+
+		if (x + 8 <= x1) {
+			memcpy(row + x, tmp, sizeof(tmp));
+		} else {
+			for (int i = 0; x + i < x1; i++)
+				row[x + i] = tmp[i];
+		}
+	}
+}
+
+__attribute__((target("avx512f"))) SIMD_NO_FMA
+static void NearestRowAVX512(Label *row, int x0, int x1, int y)
+{
+	const __m512 lanes = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	float y1 = y;
+
+	for (int x = x0; x < x1; x += 16) {
+		__m512 xs = _mm512_add_ps(_mm512_set1_ps((float)x), lanes);
+		__m512 min = _mm512_set1_ps(FLT_MAX);
+		__m512i picked = _mm512_setzero_si512();
+
+		for (int i = 0; i < simd_points_len; i++) {
+			float yd = simd_py[i] - y1;
+			__m512 xd = _mm512_sub_ps(_mm512_set1_ps(simd_px[i]), xs);
+			__m512 currdist = _mm512_add_ps(_mm512_mul_ps(xd, xd), _mm512_set1_ps(yd * yd));
+			__mmask16 closer = _mm512_cmp_ps_mask(currdist, min, _CMP_LT_OQ);
+			min = _mm512_mask_blend_ps(closer, min, currdist);
+			picked = _mm512_mask_blend_epi32(closer, picked, _mm512_set1_epi32(i));
+		}
+
+		int n = x1 - x < 16 ? x1 - x : 16;
+#ifdef WIDE_LABELS
+		_mm512_mask_storeu_epi32(row + x, (__mmask16)((1u << n) - 1), picked);
+#else
+		_mm512_mask_cvtepi32_storeu_epi16(row + x, (__mmask16)((1u << n) - 1), picked);
+#endif
+	}
+}
+
+static void CPUID(int leaf, int sub, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, leaf, sub);
+#else
+	__cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t XGETBV()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t lo, hi;
+	__asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+#endif // SIMD_X86
+
+// SIMDLevel: 0 for scalar, 1 for AVX2, 2 for AVX-512, checking both the CPU and that the OS saves
+// the wider registers
+int SIMDLevel()
+{
+#ifdef SIMD_X86
+	unsigned int regs[4];
+
+	CPUID(0, 0, regs);
+	if (regs[0] < 7)
+		return 0;
+
+	CPUID(1, 0, regs);
+	if (!(regs[2] & (1u << 27)) || !(regs[2] & (1u << 28))) // OSXSAVE, AVX
+		return 0;
+
+	uint64_t xcr0 = XGETBV();
+	if ((xcr0 & 0x6) != 0x6) // XMM, YMM
+		return 0;
+
+	CPUID(7, 0, regs);
+	if (!(regs[1] & (1u << 5))) // AVX2
+		return 0;
+
+	if ((regs[1] & (1u << 16)) && (xcr0 & 0xe6) == 0xe6) // AVX512F, opmask, ZMM
+		return 2;
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static NearestRowFunc SIMDKernel(int level)
+{
+#ifdef SIMD_X86
+	if (level >= 2)
+		return NearestRowAVX512;
+	if (level >= 1)
+		return NearestRowAVX2;
+#endif
+	return NearestRowScalar;
+}
+
+// SIMDCopyPoints: points the kernels at a structure of arrays copy of points
+static void SIMDCopyPoints(Point *points, int points_len)
+{
+	simd_points_len = points_len;
+
+	if (simd_cap < points_len) {
+		free(simd_copy_px);
+		free(simd_copy_py);
+		simd_copy_px = malloc(points_len * sizeof(*simd_copy_px));
+		simd_copy_py = malloc(points_len * sizeof(*simd_copy_py));
+		assert(simd_copy_px != NULL && simd_copy_py != NULL);
+		simd_cap = points_len;
+	}
+
+	for (int i = 0; i < points_len; i++) {
+		simd_copy_px[i] = points[i].px;
+		simd_copy_py[i] = points[i].py;
+	}
+
+	simd_px = simd_copy_px;
+	simd_py = simd_copy_py;
+}
+
+static void SIMDLoadPoints(Point *points, int points_len)
+{
+	// NOTE (Brian) the simulation already keeps its points this way, no need for a copy
+	if (G_PointSet != NULL && G_PointSet->len == points_len) {
+		simd_points_len = points_len;
+		simd_px = G_PointSet->px;
+		simd_py = G_PointSet->py;
+		return;
+	}
+
+	SIMDCopyPoints(points, points_len);
+}
+
+static int SIMDBegin(Label *labels, Point *points, int points_len)
+{
+	if (simd_kernel == NULL)
+		simd_kernel = SIMDKernel(SIMDLevel());
+
+	simd_labels = labels;
+	SIMDLoadPoints(points, points_len);
+
+	return 1;
+}
+
+static void SIMDPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++)
+		simd_kernel(simd_labels + G_WIDTH * y, x0, x1, y);
+}
+
+Engine SIMDEngine = { "simd", SIMDBegin, SIMDPhase };
+
+// BenchKernel: times UpdatePixelForPoints against every kernel this CPU can run, over frames of
+// points moving the way they do in the simulation, and checks every kernel got every frame right
+void BenchKernel(Point *points, int points_len)
+{
+	static char *names[] = { "scalar", "avx2", "avx512" };
+	const int frames = 10;
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	Label *reference = calloc(frames * total, sizeof(*reference));
+	Label *labels = calloc(total, sizeof(*labels));
+	Point *moving = malloc(points_len * sizeof(*moving));
+	assert(reference != NULL && labels != NULL && moving != NULL);
+
+	// NOTE (Brian) one frame isn't enough, an FMA only picks differently on the odd exact tie
+	memcpy(moving, points, points_len * sizeof(*moving));
+
+	double base = 0;
+	for (int f = 0; f < frames; f++) {
+		double start = GetTime();
+		for (int y = 0; y < G_HEIGHT; y++) {
+			for (int x = 0; x < G_WIDTH; x++) {
+				UpdatePixelForPoints(reference + f * total + (x + G_WIDTH * y), x, y, moving, points_len);
+			}
+		}
+		base += GetTime() - start;
+
+		for (int i = 0; i < points_len; i++)
+			MovePoint(moving + i);
+	}
+	base /= frames;
+
+	printf("%d points, %dx%d, %d frames\n", points_len, G_WIDTH, G_HEIGHT, frames);
+	printf("  %-22s %8.3fms %8.1f Mpix/s\n", "UpdatePixelForPoints", base * 1000, total / base / 1e6);
+
+	simd_labels = labels;
+
+	for (int level = 0; level <= SIMDLevel(); level++) {
+		NearestRowFunc kernel = SIMDKernel(level);
+		long long wrong = 0;
+		int first = -1;
+
+		memcpy(moving, points, points_len * sizeof(*moving));
+
+		double elapsed = 0;
+		for (int f = 0; f < frames; f++) {
+			SIMDCopyPoints(moving, points_len);
+			memset(labels, 0, total * sizeof(*labels));
+
+			double start = GetTime();
+			for (int y = 0; y < G_HEIGHT; y++)
+				kernel(labels + G_WIDTH * y, 0, G_WIDTH, y);
+			elapsed += GetTime() - start;
+
+			for (size_t i = 0; i < total; i++) {
+				if (labels[i] != reference[f * total + i]) {
+					if (first < 0)
+						first = f;
+					wrong++;
+				}
+			}
+
+			for (int i = 0; i < points_len; i++)
+				MovePoint(moving + i);
+		}
+		elapsed /= frames;
+
+		printf("  %-22s %8.3fms %8.1f Mpix/s %6.2fx ", names[level], elapsed * 1000,
+			total / elapsed / 1e6, base / elapsed);
+		if (wrong == 0)
+			printf("identical\n");
+		else
+			printf("MISMATCH %lld pixels, first in frame %d\n", wrong, first);
+	}
+
+	free(moving);
+	free(labels);
+	free(reference);
+}
@@ -0,0 +1,350 @@
+// Brian Chrzanowski
+// Spatial Index Voronoi Engines
+//
+// With hundreds of thousands of points, looking at every point for every pixel is hopeless. These
+// engines rebuild an index over the points at the start of every frame (after MovePoint has run)
+// and every pixel asks the index for its closest point instead.
+//
+// grid   - a uniform grid with about one point per cell, searched in rings outward from the pixel's
+//          cell until no unsearched cell could hold anything closer
+// kdtree - an implicit k-d tree, split on the median of the wider axis, searched near side first
+//
+// Both pick exactly the point UpdatePixelForPoints would, including ties going to the lower index.
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+// NOTE (Brian) float distances are only good to a few ulps, so when deciding whether something
+// unsearched could still be closer, we pad the best distance a little to be safe.
+#define SPATIAL_SLOP (1.0 + 1.0 / (1 << 20))
+
+typedef struct {
+	float x, y;
+	int idx;
+} IndexPoint;
+
+static Label *spatial_labels;
+static Point *spatial_points;
+static int spatial_points_len;
+
+static IndexPoint *spatial_items;
+static int spatial_items_cap;
+
+static float SpatialDist(IndexPoint *p, float x, float y)
+{
+	float xd = p->x - x;
+	float yd = p->y - y;
+	return xd * xd + yd * yd;
+}
+
+// SpatialBetter: the same order UpdatePixelForPoints uses, closest first and then lowest index
+static bool SpatialBetter(float d, int idx, float best, int bestidx)
+{
+	return d < best || (d == best && idx < bestidx);
+}
+
+static void SpatialBegin(Label *labels, Point *points, int points_len)
+{
+	spatial_labels = labels;
+	spatial_points = points;
+	spatial_points_len = points_len;
+
+	if (spatial_items_cap < points_len) {
+		free(spatial_items);
+		spatial_items = malloc(points_len * sizeof(*spatial_items));
+		assert(spatial_items != NULL);
+		spatial_items_cap = points_len;
+	}
+}
+
+static int grid_w, grid_h;
+static float grid_size;
+static int *grid_start; // grid_start[c] .. grid_start[c + 1] are the items in cell c
+static int grid_cells_cap;
+
+static int GridCoord(float v, int cells)
+{
+	int c = (int)floorf(v / grid_size);
+	if (c < 0)
+		return 0;
+	if (c >= cells)
+		return cells - 1;
+	return c;
+}
+
+static int GridBegin(Label *labels, Point *points, int points_len)
+{
+	SpatialBegin(labels, points, points_len);
+
+	grid_size = sqrtf((float)G_WIDTH * G_HEIGHT / points_len);
+	if (grid_size < 1)
+		grid_size = 1;
+	grid_w = (int)ceilf(G_WIDTH / grid_size);
+	grid_h = (int)ceilf(G_HEIGHT / grid_size);
+
+	int cells = grid_w * grid_h;
+	if (grid_cells_cap < cells + 1) {
+		free(grid_start);
+		grid_start = malloc((cells + 1) * sizeof(*grid_start));
+		assert(grid_start != NULL);
+		grid_cells_cap = cells + 1;
+	}
+
+	// counting sort the points into their cells, points wandering outside of the frame go into the
+	// edge cells, which can only make them look closer than they are
+	memset(grid_start, 0, (cells + 1) * sizeof(*grid_start));
+
+	for (int i = 0; i < points_len; i++) {
+		int c = GridCoord(points[i].px, grid_w) + grid_w * GridCoord(points[i].py, grid_h);
+		grid_start[c + 1]++;
+	}
+
+	for (int c = 0; c < cells; c++)
+		grid_start[c + 1] += grid_start[c];
+
+	for (int i = 0; i < points_len; i++) {
+		int c = GridCoord(points[i].px, grid_w) + grid_w * GridCoord(points[i].py, grid_h);
+		IndexPoint *item = spatial_items + grid_start[c]++;
+		item->x = points[i].px;
+		item->y = points[i].py;
+		item->idx = i;
+	}
+
+	// the fill loop left every start pointing at the next cell's start
+	memmove(grid_start + 1, grid_start, cells * sizeof(*grid_start));
+	grid_start[0] = 0;
+
+	return 1;
+}
+
+static void GridSearchCell(int cx, int cy, float x, float y, float *best, int *bestidx)
+{
+	int c = cx + grid_w * cy;
+
+	for (int i = grid_start[c]; i < grid_start[c + 1]; i++) {
+		IndexPoint *item = spatial_items + i;
+		float d = SpatialDist(item, x, y);
+		if (SpatialBetter(d, item->idx, *best, *bestidx)) {
+			*best = d;
+			*bestidx = item->idx;
+		}
+	}
+}
+
+// GridNearest: searches rings of cells around (x, y), starting with a guess, which is usually the
+// previous pixel's point and makes the search stop after the first ring or two
+static int GridNearest(float x, float y, int guess)
+{
+	int cx = GridCoord(x, grid_w);
+	int cy = GridCoord(y, grid_h);
+	float best = FLT_MAX;
+	int bestidx = INT32_MAX;
+
+	if (guess >= 0) {
+		Point *p = spatial_points + guess;
+		float xd = p->px - x;
+		float yd = p->py - y;
+		best = xd * xd + yd * yd;
+		bestidx = guess;
+	}
+
+	for (int r = 0;; r++) {
+		int lox = cx - r, hix = cx + r, loy = cy - r, hiy = cy + r;
+
+		if (lox < 0 && loy < 0 && hix >= grid_w && hiy >= grid_h)
+			break;
+
+		for (int j = loy; j <= hiy; j++) {
+			if (j < 0 || j >= grid_h)
+				continue;
+
+			if (j == loy || j == hiy) {
+				for (int i = lox; i <= hix; i++) {
+					if (i >= 0 && i < grid_w)
+						GridSearchCell(i, j, x, y, &best, &bestidx);
+				}
+			} else {
+				if (lox >= 0)
+					GridSearchCell(lox, j, x, y, &best, &bestidx);
+				if (hix < grid_w && hix != lox)
+					GridSearchCell(hix, j, x, y, &best, &bestidx);
+			}
+		}
+
+		// anything not searched yet is outside of this block of cells, so at least this far away,
+		// sides of the block on the edge of the grid don't count, nothing is past them
+		double edge = DBL_MAX;
+		if (lox > 0)
+			edge = fmin(edge, x - (double)lox * grid_size);
+		if (hix < grid_w - 1)
+			edge = fmin(edge, (double)(hix + 1) * grid_size - x);
+		if (loy > 0)
+			edge = fmin(edge, y - (double)loy * grid_size);
+		if (hiy < grid_h - 1)
+			edge = fmin(edge, (double)(hiy + 1) * grid_size - y);
+
+		if (bestidx != INT32_MAX && edge * edge > best * SPATIAL_SLOP)
+			break;
+	}
+
+	assert(bestidx != INT32_MAX);
+	return bestidx;
+}
+
+static void GridPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		int guess = -1;
+		for (int x = x0; x < x1; x++) {
+			guess = GridNearest(x, y, guess);
+			spatial_labels[x + G_WIDTH * y] = (Label)guess;
+		}
+	}
+}
+
+Engine GridEngine = { "grid", GridBegin, GridPhase };
+
+// the k-d tree is implicit, the node for items [lo, hi) is at (lo + hi) / 2, with the left subtree
+// in [lo, mid) and the right in [mid + 1, hi)
+static uint8_t *kd_axis;
+static int kd_axis_cap;
+
+static float KDCoord(IndexPoint *p, int axis)
+{
+	return axis ? p->y : p->x;
+}
+
+// KDSelect: quickselect, puts the k'th smallest item on the axis at k
+static void KDSelect(IndexPoint *items, int lo, int hi, int k, int axis)
+{
+	while (hi - lo > 1) {
+		float pivot = KDCoord(items + (lo + (hi - lo) / 2), axis);
+		int i = lo, j = hi - 1;
+
+		while (i <= j) {
+			while (KDCoord(items + i, axis) < pivot)
+				i++;
+			while (KDCoord(items + j, axis) > pivot)
+				j--;
+			if (i <= j) {
+				IndexPoint tmp = items[i];
+				items[i] = items[j];
+				items[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+
+		if (k <= j)
+			hi = j + 1;
+		else if (k >= i)
+			lo = i;
+		else
+			return;
+	}
+}
+
+static void KDBuild(int lo, int hi)
+{
+	if (hi - lo <= 0)
+		return;
+
+	float lox = FLT_MAX, hix = -FLT_MAX, loy = FLT_MAX, hiy = -FLT_MAX;
+	for (int i = lo; i < hi; i++) {
+		lox = fminf(lox, spatial_items[i].x);
+		hix = fmaxf(hix, spatial_items[i].x);
+		loy = fminf(loy, spatial_items[i].y);
+		hiy = fmaxf(hiy, spatial_items[i].y);
+	}
+
+	int axis = (hiy - loy) > (hix - lox);
+	int mid = lo + (hi - lo) / 2;
+
+	KDSelect(spatial_items, lo, hi, mid, axis);
+	kd_axis[mid] = axis;
+
+	KDBuild(lo, mid);
+	KDBuild(mid + 1, hi);
+}
+
+static int KDBegin(Label *labels, Point *points, int points_len)
+{
+	SpatialBegin(labels, points, points_len);
+
+	if (kd_axis_cap < points_len) {
+		free(kd_axis);
+		kd_axis = malloc(points_len * sizeof(*kd_axis));
+		assert(kd_axis != NULL);
+		kd_axis_cap = points_len;
+	}
+
+	for (int i = 0; i < points_len; i++) {
+		spatial_items[i].x = points[i].px;
+		spatial_items[i].y = points[i].py;
+		spatial_items[i].idx = i;
+	}
+
+	KDBuild(0, points_len);
+
+	return 1;
+}
+
+static void KDSearch(int lo, int hi, float x, float y, float *best, int *bestidx)
+{
+	if (hi - lo <= 0)
+		return;
+
+	int mid = lo + (hi - lo) / 2;
+	IndexPoint *node = spatial_items + mid;
+
+	float d = SpatialDist(node, x, y);
+	if (SpatialBetter(d, node->idx, *best, *bestidx)) {
+		*best = d;
+		*bestidx = node->idx;
+	}
+
+	double diff = (double)(kd_axis[mid] ? y : x) - KDCoord(node, kd_axis[mid]);
+
+	// ties on the split coordinate can land on either side, so both sides are 'near' at zero
+	if (diff < 0) {
+		KDSearch(lo, mid, x, y, best, bestidx);
+		if (diff * diff <= *best * SPATIAL_SLOP)
+			KDSearch(mid + 1, hi, x, y, best, bestidx);
+	} else {
+		KDSearch(mid + 1, hi, x, y, best, bestidx);
+		if (diff * diff <= *best * SPATIAL_SLOP)
+			KDSearch(lo, mid, x, y, best, bestidx);
+	}
+}
+
+static void KDPhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		int guess = -1;
+		for (int x = x0; x < x1; x++) {
+			float best = FLT_MAX;
+			int bestidx = INT32_MAX;
+
+			// start with the previous pixel's point, it's almost always the answer
+			if (guess >= 0) {
+				Point *p = spatial_points + guess;
+				float xd = p->px - (float)x;
+				float yd = p->py - (float)y;
+				best = xd * xd + yd * yd;
+				bestidx = guess;
+			}
+
+			KDSearch(0, spatial_points_len, x, y, &best, &bestidx);
+
+			guess = bestidx;
+			spatial_labels[x + G_WIDTH * y] = (Label)guess;
+		}
+	}
+}
+
+Engine KDTreeEngine = { "kdtree", KDBegin, KDPhase };
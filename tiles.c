@@ -0,0 +1,182 @@
+// Brian Chrzanowski
+// Tile Candidate Voronoi Engine
+//
+// The frame is cut into TILE_SIZE x TILE_SIZE tiles. For each tile we find the point whose farthest
+// distance to the tile is the smallest, and nothing whose closest distance to the tile is farther
+// than that can own any pixel in the tile. Every pixel in the tile then only looks at that short
+// list of candidates instead of every point.
+//
+// The candidates stay in index order and include anything that could tie, so pixels come out the
+// same as UpdatePixelForPoints.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "voronoi.h"
+
+#define TILE_SIZE 32
+
+// candidate count histogram buckets are 1, 2, 3-4, 5-8, ... and everything past the last
+#define TILE_BUCKETS 12
+
+#define TILE_SLOP (1.0 + 1.0 / (1 << 20))
+
+static Label *tile_labels;
+static Point *tile_points;
+static int tile_points_len;
+
+static int *tile_scratch; // tile_points_len candidates per worker
+static int tile_scratch_workers, tile_scratch_cap;
+
+static atomic_llong tile_count;
+static atomic_llong tile_candidates;
+static atomic_llong tile_max;
+static atomic_llong tile_histogram[TILE_BUCKETS];
+
+static int TileBegin(Label *labels, Point *points, int points_len)
+{
+	tile_labels = labels;
+	tile_points = points;
+	tile_points_len = points_len;
+
+	// NOTE (Brian) a frame drawn on the calling thread is worker 0, so there's always at least one
+	int workers = PoolSize() > 0 ? PoolSize() : 1;
+	if (tile_scratch_workers < workers || tile_scratch_cap < points_len) {
+		free(tile_scratch);
+		tile_scratch = malloc((size_t)workers * points_len * sizeof(*tile_scratch));
+		assert(tile_scratch != NULL);
+		tile_scratch_workers = workers;
+		tile_scratch_cap = points_len;
+	}
+
+	return 1;
+}
+
+// TileCandidates: fills candidates with every point that could own a pixel in [x0, x1) x [y0, y1)
+static int TileCandidates(int *candidates, int x0, int y0, int x1, int y1)
+{
+	double lox = x0, hix = x1 - 1, loy = y0, hiy = y1 - 1;
+	double best = DBL_MAX;
+
+	// the point with the smallest farthest distance, farthest is always a corner
+	for (int i = 0; i < tile_points_len; i++) {
+		double px = tile_points[i].px, py = tile_points[i].py;
+		double xd = fmax(fabs(px - lox), fabs(px - hix));
+		double yd = fmax(fabs(py - loy), fabs(py - hiy));
+		best = fmin(best, xd * xd + yd * yd);
+	}
+
+	best *= TILE_SLOP;
+
+	int len = 0;
+	for (int i = 0; i < tile_points_len; i++) {
+		double px = tile_points[i].px, py = tile_points[i].py;
+		double xd = px < lox ? lox - px : px > hix ? px - hix : 0;
+		double yd = py < loy ? loy - py : py > hiy ? py - hiy : 0;
+		if (xd * xd + yd * yd <= best)
+			candidates[len++] = i;
+	}
+
+	return len;
+}
+
+static void TileFill(int *candidates, int candidates_len, int x0, int y0, int x1, int y1)
+{
+	for (int y = y0; y < y1; y++) {
+		float y1f = y;
+		for (int x = x0; x < x1; x++) {
+			float x1f = x;
+			float min = FLT_MAX;
+			int picked = -1;
+
+			for (int i = 0; i < candidates_len; i++) {
+				Point *p = tile_points + candidates[i];
+				float xd = p->px - x1f;
+				float yd = p->py - y1f;
+				float currdist = xd * xd + yd * yd;
+				if (currdist < min) {
+					min = currdist;
+					picked = candidates[i];
+				}
+			}
+
+			assert(picked >= 0);
+			tile_labels[x + G_WIDTH * y] = (Label)picked;
+		}
+	}
+}
+
+static void TilePhase(int worker, int phase, int x0, int y0, int x1, int y1)
+{
+	assert(worker < tile_scratch_workers);
+	int *candidates = tile_scratch + (size_t)worker * tile_scratch_cap;
+	long long count = 0, total = 0, max = 0;
+	long long histogram[TILE_BUCKETS] = { 0 };
+
+	// rectangles don't have to line up with tiles, so work on the parts of tiles inside this one
+	for (int ty = y0 - y0 % TILE_SIZE; ty < y1; ty += TILE_SIZE) {
+		for (int tx = x0 - x0 % TILE_SIZE; tx < x1; tx += TILE_SIZE) {
+			int lox = tx < x0 ? x0 : tx;
+			int loy = ty < y0 ? y0 : ty;
+			int hix = tx + TILE_SIZE > x1 ? x1 : tx + TILE_SIZE;
+			int hiy = ty + TILE_SIZE > y1 ? y1 : ty + TILE_SIZE;
+
+			int len = TileCandidates(candidates, lox, loy, hix, hiy);
+			TileFill(candidates, len, lox, loy, hix, hiy);
+
+			int bucket = 0;
+			while ((1 << bucket) < len && bucket < TILE_BUCKETS - 1)
+				bucket++;
+
+			histogram[bucket]++;
+			count++;
+			total += len;
+			if (max < len)
+				max = len;
+		}
+	}
+
+	atomic_fetch_add(&tile_count, count);
+	atomic_fetch_add(&tile_candidates, total);
+	for (int i = 0; i < TILE_BUCKETS; i++)
+		atomic_fetch_add(&tile_histogram[i], histogram[i]);
+
+	long long prev = atomic_load(&tile_max);
+	while (prev < max && !atomic_compare_exchange_weak(&tile_max, &prev, max))
+		;
+}
+
+static void TileReport()
+{
+	long long count = atomic_exchange(&tile_count, 0);
+	long long total = atomic_exchange(&tile_candidates, 0);
+	long long max = atomic_exchange(&tile_max, 0);
+
+	if (count == 0)
+		return;
+
+	printf("  Candidates    avg %.2f  max %lld of %d points, %dx%d tiles\n",
+		(double)total / count, max, tile_points_len, TILE_SIZE, TILE_SIZE);
+
+	for (int i = 0; i < TILE_BUCKETS; i++) {
+		long long n = atomic_exchange(&tile_histogram[i], 0);
+		if (n == 0)
+			continue;
+
+		char range[32];
+		if (i <= 1)
+			snprintf(range, sizeof range, "%d", i + 1);
+		else if (i == TILE_BUCKETS - 1)
+			snprintf(range, sizeof range, "%d+", (1 << (i - 1)) + 1);
+		else
+			snprintf(range, sizeof range, "%d-%d", (1 << (i - 1)) + 1, 1 << i);
+
+		printf("    %-12s %7.3f%%\n", range, 100.0 * n / count);
+	}
+}
+
+Engine TileEngine = { "tiles", TileBegin, TilePhase, TileReport };
@@ -0,0 +1,191 @@
+// Brian Chrzanowski
+// Closed Form Trajectories
+//
+// With no acceleration, MovePoint walks each coordinate along p + n * v, and as soon as it finds
+// itself on or past a wall it turns around and walks back over exactly the same positions. So where
+// a coordinate is after t steps is just the index n bouncing between the first index past each
+// wall, a triangle wave of t, and PointAt jumps straight to any timestep without the ones between.
+//
+// To come out bit for bit the same as MovePoint, every add MovePoint does has to be exact.
+// GenerateRandomPoint puts positions and velocities on a grid of 2^-TRAJ_BITS, and a float holds
+// any multiple of that below 2^(24 - TRAJ_BITS) exactly, so the walk can be done in integers.
+// Points that aren't on the grid, accelerate, or could get outside of that range are just stepped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "voronoi.h"
+
+#define TRAJ_BITS 12
+#define TRAJ_SCALE ((float)(1 << TRAJ_BITS))
+#define TRAJ_LIMIT ((float)(1 << (24 - TRAJ_BITS)))
+
+// most starts on or past a wall are back inside after a step or two
+#define TRAJ_WALK_IN 64
+
+#define OOB(p, lo, hi) ((p) <= (lo) || (p) >= (hi))
+
+// TrajSnap: rounds f to the nearest grid point
+float TrajSnap(float f)
+{
+	return rintf(f * TRAJ_SCALE) / TRAJ_SCALE;
+}
+
+static bool TrajOnGrid(float f)
+{
+	return f * TRAJ_SCALE == rintf(f * TRAJ_SCALE);
+}
+
+// TrajExact: true if PointAt can do point in closed form
+static bool TrajExact(Point *point)
+{
+	if (point->ax != 0 || point->ay != 0)
+		return false;
+
+	if (!TrajOnGrid(point->px) || !TrajOnGrid(point->py) || !TrajOnGrid(point->vx) || !TrajOnGrid(point->vy))
+		return false;
+
+	if (OOB(point->px, 0, G_WIDTH) || OOB(point->py, 0, G_HEIGHT))
+		return false;
+
+	// it never gets further than one step past a wall
+	return G_WIDTH + fabsf(point->vx) < TRAJ_LIMIT && G_HEIGHT + fabsf(point->vy) < TRAJ_LIMIT;
+}
+
+// TrajAxis: where a coordinate starting at p inside (0, hi) with velocity v is after t steps, all in
+// grid units, and how many times it turned around on the way
+static int64_t TrajAxis(int64_t p, int64_t v, int64_t hi, int64_t t, int64_t *turns)
+{
+	*turns = 0;
+	if (v == 0)
+		return p;
+
+	// n counts steps in the direction of v, it turns around at nmax and nmin, the first ones on or
+	// past the wall in front and the wall behind
+	int64_t speed = v > 0 ? v : -v;
+	int64_t ahead = v > 0 ? hi - p : p;
+	int64_t behind = v > 0 ? p : hi - p;
+
+	int64_t nmax = (ahead + speed - 1) / speed;
+	int64_t nmin = -((behind + speed - 1) / speed);
+	int64_t len = nmax - nmin;
+
+	// at t = 0 the wave is -nmin steps into the climb from nmin to nmax
+	int64_t phase = (t - nmin) % (2 * len);
+	int64_t n = phase <= len ? nmin + phase : nmin + 2 * len - phase;
+
+	// a step turns around when it starts on a wall, which is every len steps of the wave
+	*turns = (t - nmin + len - 1) / len - (-nmin + len - 1) / len;
+
+	return p + n * v;
+}
+
+// PointAt: moves point t timesteps ahead, the same as calling MovePoint on it t times
+void PointAt(Point *point, int64_t t)
+{
+	for (int i = 0; i < TRAJ_WALK_IN && t > 0; i++, t--) {
+		if (!OOB(point->px, 0, G_WIDTH) && !OOB(point->py, 0, G_HEIGHT))
+			break;
+		MovePoint(point);
+	}
+
+	if (t <= 0)
+		return;
+
+	if (!TrajExact(point)) {
+		for (; t > 0; t--)
+			MovePoint(point);
+		return;
+	}
+
+	int64_t xturns, yturns;
+	int64_t x = TrajAxis((int64_t)(point->px * TRAJ_SCALE), (int64_t)(point->vx * TRAJ_SCALE),
+		(int64_t)G_WIDTH << TRAJ_BITS, t, &xturns);
+	int64_t y = TrajAxis((int64_t)(point->py * TRAJ_SCALE), (int64_t)(point->vy * TRAJ_SCALE),
+		(int64_t)G_HEIGHT << TRAJ_BITS, t, &yturns);
+
+	point->px = (float)x / TRAJ_SCALE;
+	point->py = (float)y / TRAJ_SCALE;
+
+	if (xturns & 1) {
+		point->ax *= -1.0f;
+		point->vx *= -1.0f;
+	}
+
+	if (yturns & 1) {
+		point->ay *= -1.0f;
+		point->vy *= -1.0f;
+	}
+
+	// NOTE (Brian) this is only ever + 0 or - 0, but it's what gives a zero velocity its sign
+	point->vx += point->ax;
+	point->vy += point->ay;
+}
+
+// BenchTrajectory: checks PointAt against stepping with MovePoint, then times seeking a long way
+void BenchTrajectory(Point *points, int points_len)
+{
+	const int64_t steps = 100000;
+	const int64_t check = 997;
+	const int64_t seek = 1000000;
+
+	Point *stepped = malloc(points_len * sizeof(*stepped));
+	Point *jumped = malloc(points_len * sizeof(*jumped));
+	assert(stepped != NULL && jumped != NULL);
+
+	int exact = 0;
+	for (int i = 0; i < points_len; i++)
+		exact += TrajExact(points + i);
+
+	memcpy(stepped, points, points_len * sizeof(*points));
+
+	long long checked = 0, wrong = 0;
+
+	for (int64_t t = 1; t <= steps; t++) {
+		for (int i = 0; i < points_len; i++)
+			MovePoint(stepped + i);
+
+		if (t % check != 0 && t != steps)
+			continue;
+
+		memcpy(jumped, points, points_len * sizeof(*points));
+		for (int i = 0; i < points_len; i++) {
+			PointAt(jumped + i, t);
+			wrong += memcmp(jumped + i, stepped + i, sizeof(*jumped)) != 0;
+			checked++;
+		}
+	}
+
+	printf("%d points, %d in closed form, %dx%d\n", points_len, exact, G_WIDTH, G_HEIGHT);
+	printf("  Checked       %lld positions over %lld steps, %lld differ from MovePoint\n",
+		checked, (long long)steps, wrong);
+
+	memcpy(jumped, points, points_len * sizeof(*points));
+
+	double start = GetTime();
+	for (int i = 0; i < points_len; i++)
+		PointAt(jumped + i, seek);
+	double closed = GetTime() - start;
+
+	memcpy(stepped, points, points_len * sizeof(*points));
+
+	start = GetTime();
+	for (int64_t t = 0; t < seek; t++) {
+		for (int i = 0; i < points_len; i++)
+			MovePoint(stepped + i);
+	}
+	double stepping = GetTime() - start;
+
+	wrong = 0;
+	for (int i = 0; i < points_len; i++)
+		wrong += memcmp(jumped + i, stepped + i, sizeof(*jumped)) != 0;
+
+	printf("  Seek          to step %lld in %.3fms, %.3fms stepping (%.0fx), %lld differ\n",
+		(long long)seek, closed * 1000, stepping * 1000, stepping / closed, wrong);
+
+	free(jumped);
+	free(stepped);
+}
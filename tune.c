@@ -0,0 +1,233 @@
+// Brian Chrzanowski
+// Auto Tuning
+//
+// How many threads and how big the tiles should be depends on the machine and the engine, so
+// instead of guessing, Tune renders a few frames with every combination from a small grid and keeps
+// the fastest. The grid comes from the hardware: fractions of the cpu count for threads, and tile
+// sizes whose labels fit comfortably in the L2 cache. The winner is written to TUNE_FILE, one line
+// per engine and resolution, and TuneLoad picks it up on later runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "voronoi.h"
+
+#define TUNE_FILE ".tune"
+#define TUNE_FRAMES 3
+
+#define TUNE_TILES 5
+
+static int tune_tiles[TUNE_TILES] = { 16, 32, 64, 128, 256 };
+
+// TuneCacheSize: the size in bytes of the data cache at level, or 0 if we can't tell
+static long TuneCacheSize(int level)
+{
+#ifdef _WIN32
+	DWORD len = 0;
+	GetLogicalProcessorInformation(NULL, &len);
+
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info = malloc(len);
+	if (info == NULL || !GetLogicalProcessorInformation(info, &len)) {
+		free(info);
+		return 0;
+	}
+
+	long size = 0;
+	for (DWORD i = 0; i < len / sizeof(*info); i++) {
+		CACHE_DESCRIPTOR *cache = &info[i].Cache;
+		if (info[i].Relationship == RelationCache && cache->Level == level && cache->Type != CacheInstruction) {
+			size = cache->Size;
+			break;
+		}
+	}
+
+	free(info);
+	return size;
+#else
+	// NOTE (Brian) sysfs has one directory per cache cpu0 can see, with its level, type and size
+	for (int index = 0; ; index++) {
+		char path[128], type[32];
+		int found_level = 0;
+		long size = 0;
+		char unit = 0;
+
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL)
+			return 0;
+		if (fscanf(fp, "%d", &found_level) != 1)
+			found_level = 0;
+		fclose(fp);
+
+		if (found_level != level)
+			continue;
+
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+		fp = fopen(path, "r");
+		if (fp == NULL || fscanf(fp, "%31s", type) != 1)
+			strcpy(type, "Unified");
+		if (fp != NULL)
+			fclose(fp);
+
+		if (strcmp(type, "Instruction") == 0)
+			continue;
+
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			return 0;
+		if (fscanf(fp, "%ld%c", &size, &unit) < 1)
+			size = 0;
+		fclose(fp);
+
+		if (unit == 'K')
+			size <<= 10;
+		else if (unit == 'M')
+			size <<= 20;
+
+		return size;
+	}
+#endif
+}
+
+// TuneLoad: sets G_THREADS and G_TileSize from the cache file, if engine has been tuned at this
+// resolution
+bool TuneLoad(Engine *engine)
+{
+	FILE *fp = fopen(TUNE_FILE, "r");
+	if (fp == NULL)
+		return false;
+
+	char name[64];
+	int width, height, threads, tile;
+	bool found = false;
+
+	while (fscanf(fp, "%63s %d %d %d %d", name, &width, &height, &threads, &tile) == 5) {
+		if (strcmp(name, engine->name) == 0 && width == G_WIDTH && height == G_HEIGHT && threads > 0 && tile > 0) {
+			G_THREADS = threads;
+			G_TileSize = tile;
+			found = true;
+		}
+	}
+
+	fclose(fp);
+	return found;
+}
+
+// TuneSave: writes the entry for engine, keeping every other entry in the file
+static void TuneSave(Engine *engine, int threads, int tile)
+{
+	char line[256];
+	char *kept = NULL;
+	size_t kept_len = 0;
+
+	FILE *fp = fopen(TUNE_FILE, "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof line, fp) != NULL) {
+			char name[64];
+			int width, height;
+			if (sscanf(line, "%63s %d %d", name, &width, &height) == 3 &&
+				strcmp(name, engine->name) == 0 && width == G_WIDTH && height == G_HEIGHT)
+				continue;
+
+			size_t len = strlen(line);
+			kept = realloc(kept, kept_len + len + 1);
+			assert(kept != NULL);
+			memcpy(kept + kept_len, line, len + 1);
+			kept_len += len;
+		}
+		fclose(fp);
+	}
+
+	fp = fopen(TUNE_FILE, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not write %s\n", TUNE_FILE);
+		free(kept);
+		return;
+	}
+
+	if (kept != NULL)
+		fputs(kept, fp);
+	fprintf(fp, "%s %d %d %d %d\n", engine->name, G_WIDTH, G_HEIGHT, threads, tile);
+	fclose(fp);
+
+	free(kept);
+}
+
+// Tune: times every thread count and tile size from the grid, then uses and saves the fastest
+void Tune(Engine *engine, Point *points, int points_len)
+{
+	int cpus = PoolCPUCount();
+	long l2 = TuneCacheSize(2);
+	long l3 = TuneCacheSize(3);
+	size_t total = (size_t)G_WIDTH * G_HEIGHT;
+
+	printf("Tuning %s at %dx%d with %d points\n", engine->name, G_WIDTH, G_HEIGHT, points_len);
+	printf("  Hardware      %d cpus, L2 %ldKB, L3 %ldKB\n", cpus, l2 >> 10, l3 >> 10);
+
+	int threads[4], threads_len = 0;
+	int quarters[] = { 1, 2, 3, 4 };
+	for (int i = 0; i < 4; i++) {
+		int n = cpus * quarters[i] / 4 > 0 ? cpus * quarters[i] / 4 : 1;
+		if (threads_len == 0 || threads[threads_len - 1] != n)
+			threads[threads_len++] = n;
+	}
+
+	// a tile's labels and the engine's per pixel state should stay in L2 while it's being worked on
+	int tiles[TUNE_TILES], tiles_len = 0;
+	for (int i = 0; i < TUNE_TILES; i++) {
+		long bytes = (long)tune_tiles[i] * tune_tiles[i] * 16;
+		if (l2 == 0 || bytes <= l2 || tune_tiles[i] <= 64)
+			tiles[tiles_len++] = tune_tiles[i];
+	}
+
+	Label *labels = malloc(total * sizeof(*labels));
+	assert(labels != NULL);
+
+	double best = 0;
+	int best_threads = G_THREADS, best_tile = G_TileSize;
+
+	for (int i = 0; i < threads_len; i++) {
+		PoolStart(threads[i]);
+		PoolFirstTouch(labels, total * sizeof(*labels));
+
+		for (int j = 0; j < tiles_len; j++) {
+			G_TileSize = tiles[j];
+
+			SchedFrame(engine, labels, points, points_len);
+
+			double start = GetTime();
+			for (int f = 0; f < TUNE_FRAMES; f++)
+				SchedFrame(engine, labels, points, points_len);
+			double elapsed = (GetTime() - start) / TUNE_FRAMES;
+
+			printf("  %3d threads  %3dx%-3d tiles  %9.3fms\n", threads[i], tiles[j], tiles[j], elapsed * 1000);
+
+			if (best == 0 || elapsed < best) {
+				best = elapsed;
+				best_threads = threads[i];
+				best_tile = tiles[j];
+			}
+		}
+
+		SchedReset();
+		PoolStop();
+	}
+
+	free(labels);
+
+	G_THREADS = best_threads;
+	G_TileSize = best_tile;
+
+	printf("  Best          %d threads, %dx%d tiles, %.3fms, saved to %s\n",
+		best_threads, best_tile, best_tile, best * 1000, TUNE_FILE);
+
+	TuneSave(engine, best_threads, best_tile);
+}
@@ -0,0 +1,441 @@
+#ifndef VORONOI_H
+#define VORONOI_H
+
+// Brian Chrzanowski
+// Types shared between main.c and the rasterizing engines
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+
+extern int G_TIMESTEPS;
+extern int G_WIDTH;
+extern int G_HEIGHT;
+extern int G_POINTS;
+extern int G_THREADS;
+
+typedef struct {
+	float px, py;
+	float vx, vy;
+	float ax, ay;
+	float w; // weight, only the weighted and power metrics look at it
+	uint32_t color;
+} Point;
+
+typedef struct {
+	uint8_t r, g, b, a;
+} Color;
+
+typedef union {
+	struct {
+		uint8_t r, g, b, a;
+	};
+	uint32_t color;
+} Pixel;
+
+// Label: the index of the point that owns a pixel. Engines only ever write labels, colors get looked
+// up from a palette afterwards. 16 bits is plenty for normal runs and half the memory traffic of a
+// Pixel, build with -DWIDE_LABELS for more than LABEL_MAX + 1 points.
+#ifdef WIDE_LABELS
+typedef uint32_t Label;
+#define LABEL_MAX UINT32_MAX
+#else
+typedef uint16_t Label;
+#define LABEL_MAX UINT16_MAX
+#endif
+
+// Metrics: what "closest" means. Each one is an expression of the point and its offset from the
+// pixel, and only has to order the points the same way the real distance would, so the Euclidean
+// one skips the square root. NEAREST_POINT gets pasted into a separate kernel for every metric, so
+// none of them pay for the others in the inner loop.
+extern float G_MinkowskiP;
+
+#define METRIC_EUCLID(p, xd, yd) ((xd) * (xd) + (yd) * (yd))
+#define METRIC_MANHATTAN(p, xd, yd) (fabsf(xd) + fabsf(yd))
+#define METRIC_CHEBYSHEV(p, xd, yd) (fabsf(xd) > fabsf(yd) ? fabsf(xd) : fabsf(yd))
+#define METRIC_MINKOWSKI(p, xd, yd) (powf(fabsf(xd), G_MinkowskiP) + powf(fabsf(yd), G_MinkowskiP))
+#define METRIC_WEIGHTED(p, xd, yd) (sqrtf((xd) * (xd) + (yd) * (yd)) - (p)->w)
+#define METRIC_POWER(p, xd, yd) ((xd) * (xd) + (yd) * (yd) - (p)->w * (p)->w)
+
+// NEAREST_POINT: sets picked to the index of the point closest to (x, y) under METRIC, ties go to
+// the lower index
+#define NEAREST_POINT(METRIC, picked, x, y, points, points_len) \
+	do { \
+		float x1_ = (x), y1_ = (y); \
+		float min_ = FLT_MAX; \
+		(picked) = -1; \
+		for (int i_ = 0; i_ < (int)(points_len); i_++) { \
+			Point *p_ = (points) + i_; \
+			float xd_ = p_->px - x1_; \
+			float yd_ = p_->py - y1_; \
+			float currdist_ = METRIC(p_, xd_, yd_); \
+			if (currdist_ < min_) { \
+				min_ = currdist_; \
+				(picked) = i_; \
+			} \
+		} \
+	} while (0)
+
+// Engine: a way of figuring out which point owns each pixel, writing its index into the labels.
+//
+// Begin is called once per frame from the main thread, before any worker touches the frame, and
+// returns the number of phases the engine needs. Each phase is run over the whole frame, possibly
+// split into rectangles across threads, and every rectangle of a phase is finished before any
+// rectangle of the next phase is started. Rectangles are half open: [x0, x1) x [y0, y1). Worker is
+// which pool worker runs the rectangle, below PoolSize(), or 0 when it's the calling thread.
+//
+// Report is optional, it prints whatever the engine counts about itself since the last Report.
+typedef struct {
+	char *name;
+	int (*Begin)(Label *labels, Point *points, int points_len);
+	void (*Phase)(int worker, int phase, int x0, int y0, int x1, int y1);
+	void (*Report)();
+} Engine;
+
+// main.c
+extern
+void UpdatePixelForPoints(Label *label, int x, int y, Point *points, size_t points_len);
+
+extern
+double GetTime();
+
+extern
+void RenderFrame(Engine *engine, Label *labels, Point *points);
+
+extern
+void MovePoint(Point *point);
+
+extern
+void GenerateRandomPoint(Point *p);
+
+extern
+void GenerateRandomWeight(Point *p);
+
+extern Engine BruteEngine;
+
+// jfa.c
+extern Engine JFAEngine;
+extern Engine JFA1Engine;
+
+// scanline.c
+extern Engine ScanlineEngine;
+
+// simd.c
+extern Engine SIMDEngine;
+
+extern
+int SIMDLevel();
+
+extern
+void BenchKernel(Point *points, int points_len);
+
+// spatial.c
+extern Engine GridEngine;
+extern Engine KDTreeEngine;
+
+// fortune.c
+extern Engine FortuneEngine;
+
+extern
+int WriteSVG(char *file, Point *points, int points_len);
+
+// incremental.c
+extern Engine IncrementalEngine;
+
+// tiles.c
+extern Engine TileEngine;
+
+// quadtree.c
+extern Engine QuadtreeEngine;
+
+// metric.c
+typedef struct {
+	char *name;
+	void (*Row)(Label *row, int x0, int x1, int y, Point *points, int points_len);
+	bool weighted; // reads Point.w, which is 0 unless GenerateRandomWeight ran
+} Metric;
+
+extern Metric *G_Metric;
+extern Metric *G_Metrics[];
+extern int G_MetricsLen;
+extern Engine MetricEngine;
+
+extern
+void BenchMetrics(Point *points, int points_len);
+
+// antialias.c
+extern bool G_AA;
+
+extern
+void ResolveAA(Pixel *pixels, Label *labels, uint32_t *palette, Point *points, int x0, int y0, int x1, int y1);
+
+extern
+void BenchAA(Engine *engine, Point *points, int points_len);
+
+// pool.c
+typedef void (*PoolFunc)(void *arg, int worker, int workers);
+
+enum {
+	PIN_NONE,
+	PIN_CORE,
+	PIN_NODE,
+};
+
+extern int G_Pin;
+
+extern
+int PoolCPUCount();
+
+extern
+int PoolSize();
+
+extern
+void PoolStart(int threads);
+
+extern
+void PoolRun(PoolFunc func, void *arg);
+
+extern
+void PoolStop();
+
+extern
+int PoolNode(int worker);
+
+extern
+int PoolNodes();
+
+extern
+void PoolFirstTouch(void *buf, size_t len);
+
+extern
+void PoolBarrier(int worker);
+
+extern
+void PoolAwait(_Atomic int *addr, int value, _Atomic int *sleepers);
+
+extern
+void PoolWake(_Atomic int *addr);
+
+extern
+void BenchPool(int threads);
+
+extern
+void *ThreadStart(void (*func)(void *arg), void *arg);
+
+extern
+void ThreadJoin(void *thread);
+
+// Queue: a bounded queue between exactly one pushing thread and one popping thread
+typedef struct {
+	void **items;
+	int cap;
+	_Atomic int head;
+	_Atomic int tail;
+	_Atomic int sleepers;
+} Queue;
+
+extern
+void QueueInit(Queue *queue, int cap);
+
+extern
+void QueueFree(Queue *queue);
+
+extern
+void QueuePush(Queue *queue, void *item);
+
+extern
+void *QueuePop(Queue *queue);
+
+// barrier.c
+enum {
+	BARRIER_CENTRAL,
+	BARRIER_DISSEMINATION,
+};
+
+// Barrier: holds threads numbered 0 to threads - 1 until all of them have called BarrierWait
+typedef struct {
+	int kind;
+	int threads;
+	int rounds;
+	struct BarrierSlot *slots; // cache line aligned, inside alloc
+	void *alloc;
+	_Alignas(64) _Atomic int count;
+	_Alignas(64) _Atomic int sense;
+	_Atomic int sleepers;
+} Barrier;
+
+extern int G_Barrier;
+
+extern
+void BarrierInit(Barrier *barrier, int threads, int kind);
+
+extern
+void BarrierFree(Barrier *barrier);
+
+extern
+void BarrierWait(Barrier *barrier, int thread);
+
+extern
+void BenchBarrier(int threads);
+
+// sched.c
+typedef void (*TileFunc)(void *arg, int worker, int phase, int x0, int y0, int x1, int y1);
+
+extern int G_TileSize;
+
+extern
+void SchedRun(TileFunc func, void *arg, int phases);
+
+extern
+void SchedReport();
+
+extern
+void SchedReset();
+
+extern
+void SchedFrame(Engine *engine, Label *labels, Point *points, int points_len);
+
+extern
+void BenchSched(Engine *engine, Point *points, int points_len, int threads);
+
+extern
+void BenchScaling(Engine *engine, Point *points, int points_len, int threads);
+
+// lloyd.c
+extern bool G_Lloyd;
+
+extern
+void LloydInit(int workers, int points_len);
+
+extern
+void LloydFree();
+
+extern
+void LloydAccumulate(int worker, Label *labels, int x0, int y0, int x1, int y1);
+
+extern
+void LloydStep(Point *points, int worker, int workers);
+
+extern
+void LloydMoved(double *mean, double *max);
+
+extern
+double LloydReduceTime();
+
+// points.c
+
+// PointSet: the motion of the points as a structure of arrays, each one cache line aligned
+typedef struct {
+	float *px, *py;
+	float *vx, *vy;
+	float *ax, *ay;
+	int len;
+	void *alloc;
+} PointSet;
+
+// the simulation's points, when there is a set in sync with the Points handed to the engines
+extern PointSet *G_PointSet;
+
+extern
+void PointSetInit(PointSet *set, int len);
+
+extern
+void PointSetFree(PointSet *set);
+
+extern
+void PointSetLoad(PointSet *set, Point *points, int lo, int hi);
+
+extern
+void PointSetStore(PointSet *set, Point *points, int lo, int hi);
+
+extern
+void PointSetStep(PointSet *set, int lo, int hi);
+
+extern
+void BenchStep(Point *points, int points_len, int threads);
+
+// collide.c
+extern bool G_Collide;
+extern float G_Radius;
+
+extern
+void CollideInit(int workers, int points_len);
+
+extern
+void CollideFree();
+
+extern
+void CollideStep(PointSet *set, int worker, int workers);
+
+extern
+void CollideReport();
+
+extern
+void BenchCollide(int threads);
+
+// force.c
+extern float G_Force;
+extern float G_Theta;
+
+extern
+void ForceInit(int workers, int points_len);
+
+extern
+void ForceFree();
+
+extern
+void ForceStep(PointSet *set, int worker, int workers);
+
+extern
+void ForceReport();
+
+extern
+void BenchForce(int threads);
+
+// blur.c
+extern int G_Blur;
+
+extern
+void BlurBegin(Point *points, Point *next, int points_len);
+
+extern
+void ResolveBlur(Pixel *pixels, uint32_t *palette, int x0, int y0, int x1, int y1);
+
+extern
+void BlurReport();
+
+extern
+void BenchBlur(Point *points, int points_len);
+
+// trajectory.c
+extern
+float TrajSnap(float f);
+
+extern
+void PointAt(Point *point, int64_t t);
+
+extern
+void BenchTrajectory(Point *points, int points_len);
+
+// tune.c
+extern
+bool TuneLoad(Engine *engine);
+
+extern
+void Tune(Engine *engine, Point *points, int points_len);
+
+// palette.c
+extern
+void FillLabels(Label *labels, Label label, int n);
+
+extern
+void BuildPalette(uint32_t *palette, Point *points, int points_len, int shift);
+
+extern
+void ResolvePalette(Pixel *pixels, Label *labels, uint32_t *palette, int x0, int y0, int x1, int y1);
+
+extern
+void BenchPalette(Engine *engine, Point *points, int points_len);
+
+#endif // VORONOI_H